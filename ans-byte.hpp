@@ -1,6 +1,11 @@
 #pragma once
 
+#include <array>
+#include <string>
+#include <type_traits>
+
 #include "ans-constants.hpp"
+#include "ans-stats.hpp"
 #include "ans-util.hpp"
 
 using freq_table = std::array<uint64_t, constants::MAX_SIGMA>;
@@ -9,19 +14,101 @@ struct dec_table_entry {
     uint32_t freq;
     uint64_t offset;
     uint32_t sym;
+
+    static std::string name_suffix() { return ""; }
+    static dec_table_entry pack(uint32_t sym, uint32_t freq, uint32_t offset)
+    {
+        return dec_table_entry{ freq, offset, sym };
+    }
+    uint32_t get_freq() const { return freq; }
+    uint32_t get_offset() const { return offset; }
+    uint32_t get_sym() const { return sym; }
 };
 
-template <uint32_t t_frame_size> struct ans_byte_model {
+/* compact entry packed into 32 bits: (freq-1):12 | offset:12 | sym:8. a
+   4096 slot frame takes 16 KB instead of 96 KB and stays L1-resident */
+struct dec_table_entry_u32 {
+    uint32_t v;
+
+    static const uint32_t max_frame_size = 4096;
+    static std::string name_suffix() { return "_c"; }
+    static dec_table_entry_u32 pack(
+        uint32_t sym, uint32_t freq, uint32_t offset)
+    {
+        return dec_table_entry_u32{ (freq - 1) | (offset << 12) | (sym << 24) };
+    }
+    uint32_t get_freq() const { return (v & 0xFFF) + 1; }
+    uint32_t get_offset() const { return (v >> 12) & 0xFFF; }
+    uint32_t get_sym() const { return v >> 24; }
+};
+
+/* interleaved rANS over a single byte stream. symbol i is coded with state
+   i % t_num_states so consecutive symbols do not depend on each other's
+   state update. all states start at the lower bound of the normalization
+   interval (instead of ANS_START_STATE) so the decoder never has to guess
+   which state owns the remaining bytes at the end of the stream */
+template <uint32_t t_num_states, class t_model>
+uint8_t* ans_byte_encode_interleaved(
+    const t_model& m, const uint8_t* in, size_t n, uint8_t* out8)
+{
+    static_assert(t_num_states == 1 || t_num_states == 2 || t_num_states == 4
+            || t_num_states == 8,
+        "interleaved rANS supports 1, 2, 4 or 8 states");
+    std::array<uint32_t, t_num_states> states;
+    states.fill(m.norm_lower_bound);
+    // we encode the input in reverse order
+    for (size_t i = n; i != 0; i--) {
+        auto& state = states[(i - 1) % t_num_states];
+        state = m.encode(state, in[i - 1], out8);
+    }
+    // flush in reverse so the decoder reads state 0 first
+    for (size_t k = t_num_states; k != 0; k--) {
+        m.flush(states[k - 1], out8);
+    }
+    return out8;
+}
+
+template <uint32_t t_num_states, class t_model>
+void ans_byte_decode_interleaved(const t_model& m, const uint8_t*& in8,
+    size_t enc_size, uint8_t* out, size_t n)
+{
+    std::array<uint32_t, t_num_states> states;
+    for (size_t k = 0; k < t_num_states; k++) {
+        states[k] = m.init_decoder(in8, enc_size);
+    }
+    size_t i = 0;
+    size_t n_full = n - (n % t_num_states);
+    for (; i < n_full; i += t_num_states) {
+        for (size_t k = 0; k < t_num_states; k++) {
+            out[i + k] = m.decode(states[k], in8, enc_size);
+        }
+    }
+    for (size_t k = 0; i < n; i++, k++) {
+        out[i] = m.decode(states[k], in8, enc_size);
+    }
+}
+
+template <uint32_t t_frame_size, class t_dec_entry = dec_table_entry>
+struct ans_byte_model {
+    static_assert(std::is_same<t_dec_entry, dec_table_entry>::value
+            || t_frame_size <= dec_table_entry_u32::max_frame_size,
+        "compact decode entries only hold frame sizes up to 4096");
+
+public:
+    using dec_entry_type = t_dec_entry;
+    static std::string name_suffix() { return t_dec_entry::name_suffix(); }
+
 public:
-    uint32_t M; // frame size
+    uint32_t M = 0; // frame size
     std::vector<uint64_t> normalized_freqs;
     std::vector<uint64_t> base;
     std::vector<uint64_t> sym_upper_bound;
+    std::vector<ans_reciprocal> rcp_freqs;
     uint8_t log2_M;
     uint64_t mask_M;
     uint64_t norm_lower_bound;
     std::vector<uint32_t> csum2sym;
-    std::vector<dec_table_entry> dec_table;
+    std::vector<t_dec_entry> dec_table;
 
 public:
     ans_byte_model() = default;
@@ -34,6 +121,10 @@ public:
             normalized_freqs[i] = ans_vbyte_decode_u64(in8);
         }
 
+        // (1a) empty model??
+        if (n == 0)
+            return;
+
         // (2) init the model
         init_model();
     }
@@ -70,6 +161,7 @@ public:
         normalized_freqs.resize(max_num_representable + 1);
         base.resize(max_num_representable + 1);
         sym_upper_bound.resize(max_num_representable + 1);
+        rcp_freqs.resize(max_num_representable + 1);
 
         // (4) fill the tables
         uint32_t cumsum = 0;
@@ -83,6 +175,8 @@ public:
             sym_upper_bound[j]
                 = ((norm_lower_bound / M) * constants::OUTPUT_BASE)
                 * normalized_freqs[j];
+            if (normalized_freqs[j] != 0)
+                rcp_freqs[j] = ans_reciprocal(normalized_freqs[j]);
         }
         mask_M = M - 1;
         log2_M = log2(M);
@@ -105,9 +199,7 @@ public:
         for (size_t j = 0; j < normalized_freqs.size(); j++) {
             uint16_t cur_freq = normalized_freqs[j];
             for (size_t k = 0; k < cur_freq; k++) {
-                dec_table[base + k].sym = j;
-                dec_table[base + k].freq = cur_freq;
-                dec_table[base + k].offset = k;
+                dec_table[base + k] = t_dec_entry::pack(j, cur_freq, k);
             }
             base += cur_freq;
         }
@@ -124,22 +216,25 @@ public:
             state = state >> constants::OUTPUT_BASE_LOG2;
         }
 
-        // (2) transform state
-        uint64_t next = ((state / f) * M) + (state % f) + b;
+        // (2) transform state. q = state / f without a division
+        uint32_t q = rcp_freqs[sym].div(state);
+        uint64_t next = (uint64_t(q) << log2_M) + (state - q * f) + b;
         return next;
     }
     uint8_t decode(uint32_t& state, const uint8_t*& in8, size_t& enc_size) const
     {
         uint64_t state_mod_M = state & mask_M;
-        const auto& entry = dec_table[state_mod_M];
+        const auto entry = dec_table[state_mod_M];
         // update state and renormalize
-        state = entry.freq * (state >> log2_M) + entry.offset;
+        state = entry.get_freq() * (state >> log2_M) + entry.get_offset();
+        ANS_STAT_ADD(byte_syms, 1);
         while (enc_size && state < norm_lower_bound) {
             uint8_t new_byte = *in8++;
             state = (state << constants::OUTPUT_BASE_LOG2) | uint32_t(new_byte);
             enc_size--;
+            ANS_STAT_ADD(byte_renorm_bytes, 1);
         }
-        return entry.sym;
+        return entry.get_sym();
     }
     uint32_t init_decoder(const uint8_t*& in8, size_t& enc_size) const
     {
@@ -159,4 +254,246 @@ public:
             ans_vbyte_encode_u64(out8, normalized_freqs[i]);
         }
     }
+    /* encode n symbols backwards into the buffer ending at out8 and return
+       the start of the encoding */
+    template <uint32_t t_num_states>
+    uint8_t* encode_block(const uint8_t* in, size_t n, uint8_t* out8) const
+    {
+        if (t_num_states != 1) {
+            return ans_byte_encode_interleaved<t_num_states>(
+                *this, in, n, out8);
+        }
+        uint32_t state = constants::ANS_START_STATE;
+        auto encin = in + n - 1;
+        // we encode the input in reverse order as well
+        for (size_t i = 0; i < n; i++) {
+            uint8_t sym = *encin--;
+            state = encode(state, sym, out8);
+        }
+        flush(state, out8);
+        return out8;
+    }
+    template <uint32_t t_num_states>
+    void decode_block(const uint8_t*& in8, size_t enc_size, uint8_t* out,
+        size_t n) const
+    {
+        if (t_num_states != 1) {
+            ans_byte_decode_interleaved<t_num_states>(
+                *this, in8, enc_size, out, n);
+            return;
+        }
+        uint32_t state = init_decoder(in8, enc_size);
+        for (size_t k = 0; k < n; k++) {
+            *out++ = decode(state, in8, enc_size);
+        }
+    }
+};
+
+struct tans_dec_entry {
+    uint16_t new_base;
+    uint8_t sym;
+    uint8_t nb_bits;
+};
+
+/* table-based ANS (FSE style) over the same normalized frequencies as
+   ans_byte_model. states live in [L,2L) with L = M and are renormalized
+   bit-wise, so both encoding and decoding are a table lookup plus a shift.
+   the bits of all symbols form a stack: the encoder pushes them in reverse
+   symbol order, the decoder pops them front to back. */
+template <uint32_t t_frame_size> struct tans_byte_model {
+    static_assert(t_frame_size <= (1 << 15)
+            && (t_frame_size & (t_frame_size - 1)) == 0,
+        "tans table size has to be a power of 2 that fits in 16 bits");
+
+public:
+    static std::string name_suffix() { return "_tans"; }
+
+public:
+    uint32_t M = t_frame_size; // table size == L
+    uint8_t log2_M = 0;
+    std::vector<uint64_t> normalized_freqs;
+    std::vector<uint32_t> cumsum;
+    std::vector<uint32_t> delta_nb_bits;
+    std::vector<uint16_t> enc_table;
+    std::vector<tans_dec_entry> dec_table;
+
+public:
+    tans_byte_model() = default;
+    tans_byte_model(const uint8_t*& in8)
+    {
+        // (1) read the normalized frequencies
+        auto n = ans_vbyte_decode_u64(in8);
+        normalized_freqs.resize(n);
+        for (size_t i = 0; i < normalized_freqs.size(); i++) {
+            normalized_freqs[i] = ans_vbyte_decode_u64(in8);
+        }
+
+        // (2) init the model
+        init_model();
+    }
+    tans_byte_model(tans_byte_model&&) = default;
+    tans_byte_model& operator=(tans_byte_model&&) = default;
+    tans_byte_model& operator=(const tans_byte_model&) = default;
+    tans_byte_model(const freq_table& freqs)
+    {
+        // (0) if all is 0 do nothing
+        if (std::all_of(freqs.cbegin(), freqs.cend(),
+                [](uint64_t i) { return i == 0; })) {
+            return;
+        }
+
+        // (1) normalize such that the normalized freqs sum to a power of 2
+        normalized_freqs
+            = normalize_freqs_power_of_two_alistair(freqs, t_frame_size);
+
+        // (2) init the tables
+        init_model();
+    }
+
+    void init_model()
+    {
+        // (1) figure out the largest symbol and the table size
+        size_t sigma = 0;
+        for (size_t i = 0; i < normalized_freqs.size(); i++) {
+            if (normalized_freqs[i] != 0)
+                sigma = i + 1;
+        }
+        if (sigma == 0) // empty model
+            return;
+        normalized_freqs.resize(sigma);
+        cumsum.resize(sigma + 1);
+        delta_nb_bits.resize(sigma);
+        for (size_t i = 0; i < sigma; i++) {
+            cumsum[i + 1] = cumsum[i] + normalized_freqs[i];
+        }
+        M = cumsum[sigma];
+        log2_M = bits::hi(M);
+        if (!is_power_of_two(M) || M > t_frame_size) {
+            quit("tans table size %u is not a power of 2 <= %u", M,
+                t_frame_size);
+        }
+
+        // (2) spread the symbols over the table
+        std::vector<uint8_t> spread(M);
+        uint32_t step = (M >> 1) + (M >> 3) + 3;
+        uint32_t pos = 0;
+        for (size_t s = 0; s < sigma; s++) {
+            for (size_t i = 0; i < normalized_freqs[s]; i++) {
+                spread[pos] = s;
+                pos = (pos + step) & (M - 1);
+            }
+        }
+
+        // (3) build the state transition tables
+        std::vector<uint32_t> next(normalized_freqs.begin(),
+            normalized_freqs.end());
+        enc_table.resize(M);
+        dec_table.resize(M);
+        for (uint32_t i = 0; i < M; i++) {
+            uint8_t s = spread[i];
+            uint32_t x_s = next[s]++;
+            uint8_t nb_bits = log2_M - bits::hi(x_s);
+            enc_table[cumsum[s] + x_s - normalized_freqs[s]] = M + i;
+            dec_table[i].sym = s;
+            dec_table[i].nb_bits = nb_bits;
+            dec_table[i].new_base = (x_s << nb_bits) - M;
+        }
+        for (size_t s = 0; s < sigma; s++) {
+            uint32_t f = normalized_freqs[s];
+            if (f == 0)
+                continue;
+            uint32_t max_bits_out = log2_M - bits::hi(f - 1);
+            uint32_t min_state_plus = f << max_bits_out;
+            delta_nb_bits[s] = (max_bits_out << 16) - min_state_plus;
+        }
+    }
+    void write(uint8_t*& out8) const
+    {
+        ans_vbyte_encode_u64(out8, normalized_freqs.size());
+        for (size_t i = 0; i < normalized_freqs.size(); i++) {
+            ans_vbyte_encode_u64(out8, normalized_freqs[i]);
+        }
+    }
+    /* encode n symbols backwards into the buffer ending at out8 and return
+       the start of the encoding. the stream is [states][bits] where the
+       first state also stores the number of padding bits */
+    template <uint32_t t_num_states>
+    uint8_t* encode_block(const uint8_t* in, size_t n, uint8_t* out8) const
+    {
+        std::array<uint32_t, t_num_states> states;
+        states.fill(M);
+        uint64_t bit_buf = 0;
+        uint32_t bits_in_buf = 0;
+        for (size_t i = n; i != 0; i--) {
+            auto& x = states[(i - 1) % t_num_states];
+            uint8_t sym = in[i - 1];
+            // (1) push the low bits of the state
+            uint32_t nb_bits = (x + delta_nb_bits[sym]) >> 16;
+            bit_buf = (bit_buf << nb_bits) | (x & bits::lo_set[nb_bits]);
+            bits_in_buf += nb_bits;
+            while (bits_in_buf >= 8) {
+                bits_in_buf -= 8;
+                *--out8 = uint8_t(bit_buf >> bits_in_buf);
+            }
+            bit_buf &= bits::lo_set[bits_in_buf];
+            // (2) transition
+            uint32_t x_s = x >> nb_bits;
+            x = enc_table[cumsum[sym] + x_s - normalized_freqs[sym]];
+        }
+        // (3) pad the remaining bits to a full byte
+        uint32_t padding = (8 - bits_in_buf) % 8;
+        if (bits_in_buf != 0) {
+            *--out8 = uint8_t(bit_buf << padding);
+        }
+        // (4) flush in reverse so the decoder reads state 0 first
+        for (size_t k = t_num_states; k != 0; k--) {
+            uint64_t val = states[k - 1] - M;
+            if (k == 1)
+                val = (val << 3) | padding;
+            out8 -= ans_vbyte_size(val);
+            auto tmp = out8;
+            ans_vbyte_encode_u64(tmp, val);
+        }
+        return out8;
+    }
+    template <uint32_t t_num_states>
+    void decode_block(const uint8_t*& in8, size_t enc_size, uint8_t* out,
+        size_t n) const
+    {
+        const uint8_t* in_end = in8 + enc_size;
+        // (1) read the states
+        std::array<uint32_t, t_num_states> states;
+        uint32_t padding = 0;
+        for (size_t k = 0; k < t_num_states; k++) {
+            uint64_t val = ans_vbyte_decode_u64(in8);
+            if (k == 0) {
+                padding = val & 7;
+                val >>= 3;
+            }
+            states[k] = val;
+        }
+        // (2) skip the padding bits
+        uint64_t bit_buf = 0;
+        uint32_t bits_in_buf = 0;
+        while (bits_in_buf <= 56 && in8 != in_end) {
+            bit_buf |= uint64_t(*in8++) << bits_in_buf;
+            bits_in_buf += 8;
+        }
+        bit_buf >>= padding;
+        bits_in_buf -= padding;
+        // (3) decode
+        for (size_t i = 0; i < n; i++) {
+            auto& x = states[i % t_num_states];
+            const auto& entry = dec_table[x];
+            *out++ = entry.sym;
+            x = entry.new_base + (bit_buf & bits::lo_set[entry.nb_bits]);
+            bit_buf >>= entry.nb_bits;
+            bits_in_buf -= entry.nb_bits;
+            while (bits_in_buf <= 56 && in8 != in_end) {
+                bit_buf |= uint64_t(*in8++) << bits_in_buf;
+                bits_in_buf += 8;
+            }
+        }
+        in8 = in_end;
+    }
 };
@@ -8,23 +8,149 @@ struct mag_enc_table_entry {
     uint32_t freq;
     uint64_t base;
     uint32_t SUB;
+    ans_reciprocal rcp_freq;
+    ans_reciprocal rcp_freq_u64;
 };
 
 struct mag_dec_table_entry {
     uint32_t freq;
     uint64_t offset;
     uint32_t sym;
+
+    static std::string name_suffix() { return ""; }
+    static mag_dec_table_entry pack(
+        uint32_t sym, uint32_t freq, uint32_t offset)
+    {
+        return mag_dec_table_entry{ freq, offset, sym };
+    }
+    uint32_t get_freq(const mag_table&) const { return freq; }
+    uint32_t get_offset() const { return offset; }
+    uint32_t get_sym() const { return sym; }
+};
+
+/* compact 8 byte entry. all values of a magnitude share the same
+   normalized frequency so we recover it from the symbol instead of
+   storing it in every slot */
+struct mag_dec_table_entry_u64 {
+    uint32_t sym;
+    uint32_t offset;
+
+    static std::string name_suffix() { return "_c"; }
+    static mag_dec_table_entry_u64 pack(uint32_t sym, uint32_t, uint32_t offset)
+    {
+        return mag_dec_table_entry_u64{ sym, offset };
+    }
+    uint32_t get_freq(const mag_table& norm_mags) const
+    {
+        return norm_mags[ans_magnitude(sym)];
+    }
+    uint32_t get_offset() const { return offset; }
+    uint32_t get_sym() const { return sym; }
+};
+
+/* flat decode table with one entry per slot of the frame */
+template <class t_dec_entry> struct mag_dec_table {
+    std::vector<t_dec_entry> table;
+
+    void init(const mag_table& norm_mags, uint64_t total_max_val, uint64_t M)
+    {
+        table.resize(M);
+        size_t base = 0;
+        for (size_t i = 0; i < norm_mags.size(); i++) {
+            auto cur_freq = norm_mags[i];
+            if (cur_freq == 0)
+                continue;
+            auto min_val = ans_min_val_in_mag(i);
+            auto max_val = ans_max_val_in_mag(i, total_max_val);
+            for (size_t j = min_val; j <= max_val; j++) {
+                for (size_t k = 0; k < cur_freq; k++) {
+                    table[base + k] = t_dec_entry::pack(j, cur_freq, k);
+                }
+                base += cur_freq;
+            }
+        }
+    }
+    mag_dec_table_entry lookup(uint64_t slot, const mag_table& norm_mags) const
+    {
+        const auto entry = table[slot];
+        return mag_dec_table_entry{ entry.get_freq(norm_mags),
+            entry.get_offset(), entry.get_sym() };
+    }
+};
+
+/* tag selecting the magnitude factored decode table below */
+struct mag_dec_factored {
+    static std::string name_suffix() { return "_f"; }
+};
+
+/* magnitude factored decode table. all values of a magnitude share the
+   same freq and occupy consecutive runs of slots, so we only store the
+   first slot of each magnitude and recover the value and its offset from
+   the distance to it. a small index from the top bits of the slot to the
+   first magnitude overlapping it avoids searching all magnitudes. the
+   whole table is O(MAX_MAG) independent of M */
+template <> struct mag_dec_table<mag_dec_factored> {
+    static const uint8_t INDEX_LOG2 = 10;
+    std::array<uint64_t, constants::MAX_MAG + 2> base{};
+    std::array<uint32_t, constants::MAX_MAG + 1> min_val{};
+    std::array<ans_reciprocal, constants::MAX_MAG + 1> rcp_freq{};
+    std::vector<uint8_t> slot_mag;
+    uint8_t index_shift = 0;
+
+    void init(const mag_table& norm_mags, uint64_t total_max_val, uint64_t M)
+    {
+        // (1) first slot of each magnitude. base[MAX_MAG + 1] = M
+        uint8_t log2_M = log2(M);
+        uint64_t cumsum = 0;
+        for (size_t i = 0; i < norm_mags.size(); i++) {
+            base[i] = cumsum;
+            min_val[i] = ans_min_val_in_mag(i);
+            auto max_val = ans_max_val_in_mag(i, total_max_val);
+            if (norm_mags[i] == 0 || max_val < min_val[i])
+                continue;
+            cumsum += norm_mags[i] * (max_val - min_val[i] + 1);
+            rcp_freq[i] = ans_reciprocal(norm_mags[i], log2_M);
+        }
+        base[norm_mags.size()] = cumsum;
+
+        // (2) slot index. entry b is the magnitude containing the
+        // first slot of bucket b
+        uint8_t index_log2 = log2_M < INDEX_LOG2 ? log2_M : INDEX_LOG2;
+        index_shift = log2_M - index_log2;
+        slot_mag.resize(1ULL << index_log2);
+        uint8_t mag = 0;
+        for (size_t b = 0; b < slot_mag.size(); b++) {
+            uint64_t slot = uint64_t(b) << index_shift;
+            while (slot >= base[mag + 1])
+                mag++;
+            slot_mag[b] = mag;
+        }
+    }
+    mag_dec_table_entry lookup(uint64_t slot, const mag_table& norm_mags) const
+    {
+        uint8_t mag = slot_mag[slot >> index_shift];
+        while (slot >= base[mag + 1])
+            mag++;
+        uint64_t f = norm_mags[mag];
+        uint64_t rel = slot - base[mag];
+        uint64_t idx = rcp_freq[mag].div(rel);
+        return mag_dec_table_entry{ uint32_t(f), rel - idx * f,
+            uint32_t(min_val[mag] + idx) };
+    }
 };
 
-struct ans_mag_model_fast {
+template <class t_dec_entry = mag_dec_table_entry> struct ans_mag_model_fast {
+public:
+    static std::string name_suffix() { return t_dec_entry::name_suffix(); }
+
 public:
     uint64_t M; // frame size
-    std::vector<mag_enc_table_entry> enc_table;
+    std::array<mag_enc_table_entry, constants::MAX_MAG + 1> enc_table{};
     mag_table norm_mags = { { 0 } };
     uint8_t log2_M = 0;
     uint64_t mask_M = 0;
     uint64_t norm_lower_bound = 0;
-    std::vector<mag_dec_table_entry> dec_table;
+    mag_dec_table<t_dec_entry> dec_table;
     uint64_t total_max_val = 0;
 
 public:
@@ -66,53 +192,55 @@ public:
 
     void init_model()
     {
-        // (1) allocate space
-        enc_table.resize(total_max_val + 1);
-
-        // (2) fill the tables
+        // (1) fill the per magnitude table. all values in a magnitude share
+        // the same freq and are laid out consecutively in the frame
         uint64_t cumsum = 0;
         for (size_t i = 0; i < norm_mags.size(); i++) {
+            enc_table[i].freq = norm_mags[i];
+            enc_table[i].base = cumsum;
             if (norm_mags[i] == 0)
                 continue;
             auto min_val = ans_min_val_in_mag(i);
             auto max_val = ans_max_val_in_mag(i, total_max_val);
-            for (size_t j = min_val; j <= max_val; j++) {
-                enc_table[j].freq = norm_mags[i];
-                enc_table[j].base = cumsum;
-                cumsum += enc_table[j].freq;
-            }
+            if (max_val < min_val)
+                continue;
+            cumsum += norm_mags[i] * (max_val - min_val + 1);
         }
         M = cumsum;
         norm_lower_bound = constants::OUTPUT_BASE * M;
-        for (size_t j = 1; j < enc_table.size(); j++) {
-            enc_table[j].SUB = ((norm_lower_bound / M) * constants::OUTPUT_BASE)
-                * enc_table[j].freq;
+        for (size_t i = 0; i < enc_table.size(); i++) {
+            enc_table[i].SUB = ((norm_lower_bound / M) * constants::OUTPUT_BASE)
+                * enc_table[i].freq;
+            if (enc_table[i].freq != 0) {
+                enc_table[i].rcp_freq = ans_reciprocal(enc_table[i].freq);
+                enc_table[i].rcp_freq_u64
+                    = ans_reciprocal(enc_table[i].freq, 63);
+            }
         }
         mask_M = M - 1;
         log2_M = log2(M);
 
-        // create csum table for decoding
-        dec_table.resize(M);
-        size_t base = 0;
-        for (size_t j = 1; j < enc_table.size(); j++) {
-            auto cur_freq = enc_table[j].freq;
-            for (size_t k = 0; k < cur_freq; k++) {
-                dec_table[base + k].sym = j;
-                dec_table[base + k].freq = cur_freq;
-                dec_table[base + k].offset = k;
-            }
-            base += cur_freq;
-        }
+        // (2) create the decoding table
+        dec_table.init(norm_mags, total_max_val, M);
         fprintf(stderr, "M = %lu\n", M);
         if (cumsum != M) {
             fprintf(stderr, "cumsum %lu != M %lu\n", cumsum, M);
         }
     }
+    /* base of num in the frame. values of a magnitude follow each other
+       so the offset within the magnitude is a multiple of its freq */
+    uint64_t enc_base(const mag_enc_table_entry& entry, uint32_t num,
+        uint8_t mag) const
+    {
+        uint64_t offset = num - ans_min_val_in_mag(mag);
+        return entry.base + offset * entry.freq;
+    }
     uint64_t encode(uint64_t state, uint32_t num, uint8_t*& out8) const
     {
-        const auto& entry = enc_table[num];
+        auto mag = ans_magnitude(num);
+        const auto& entry = enc_table[mag];
         uint64_t f = entry.freq;
-        uint64_t b = entry.base;
+        uint64_t b = enc_base(entry, num, mag);
         // (1) normalize
         while (state >= entry.SUB) {
             --out8;
@@ -120,11 +248,21 @@ public:
             state = state >> constants::OUTPUT_BASE_LOG2;
         }
 
-        // (2) transform state
-        uint64_t next = ((state / f) * M) + (state % f) + b;
+        // (2) transform state. q = state / f without a division
+        uint64_t q = entry.rcp_freq.div(state);
+        uint64_t next = (q << log2_M) + (state - q * f) + b;
         return next;
     }
 
+    /* state / f for the unnormalized states of the u64 coders. the
+       reciprocal is exact below 2^63, only larger states divide */
+    static uint64_t div_u64(const mag_enc_table_entry& entry, uint64_t state)
+    {
+        if (state >> 63)
+            return state / entry.freq;
+        return entry.rcp_freq_u64.div(state);
+    }
+
     std::pair<uint64_t, uint64_t> try_encode_u64(
         const uint32_t* in, size_t n) const
     {
@@ -132,15 +270,16 @@ public:
         uint64_t num_encoded = 0;
         for (size_t i = 0; i < n; i++) {
             auto num = in[i];
-            if (num > total_max_val)
+            if (num == 0 || num > total_max_val)
                 break;
-            const auto& entry = enc_table[num];
+            auto mag = ans_magnitude(num);
+            const auto& entry = enc_table[mag];
             if (entry.freq == 0)
                 break;
             uint64_t f = entry.freq;
-            uint64_t b = entry.base + 1;
-            uint64_t r = state % f;
-            uint64_t j = (state - r) / f;
+            uint64_t b = enc_base(entry, num, mag) + 1;
+            uint64_t j = div_u64(entry, state);
+            uint64_t r = state - j * f;
             uint64_t new_state = 0;
             if (__builtin_umull_overflow(j, M, &new_state)) {
                 break;
@@ -161,11 +300,12 @@ public:
         uint64_t state = 0;
         for (size_t i = 0; i < n; i++) {
             auto num = in[i];
-            const auto& entry = enc_table[num];
+            auto mag = ans_magnitude(num);
+            const auto& entry = enc_table[mag];
             uint64_t f = entry.freq;
-            uint64_t b = entry.base + 1;
-            uint64_t r = state % f;
-            uint64_t j = (state - r) / f;
+            uint64_t b = enc_base(entry, num, mag) + 1;
+            uint64_t j = div_u64(entry, state);
+            uint64_t r = state - j * f;
             state = j * M + r + b;
         }
         return state;
@@ -173,27 +313,25 @@ public:
 
     void decode_u64(uint64_t state, uint32_t*& out) const
     {
-        static std::vector<uint32_t> stack(constants::MAXSTACKSIZE);
-        size_t num_decoded = 0;
+        // symbols come out last to first. write them and reverse in place
+        auto out_start = out;
         while (state > 0) {
             uint64_t r = 1ULL + ((state - 1ULL) & mask_M);
             uint64_t j = (state - r) >> log2_M;
-            const auto& entry = dec_table[r - 1];
+            const auto entry = dec_table.lookup(r - 1, norm_mags);
             uint64_t f = entry.freq;
             uint64_t b = entry.offset;
-            stack[num_decoded++] = entry.sym;
+            *out++ = entry.sym;
             state = f * j + b;
         }
-        for (size_t j = 0; j < num_decoded; j++) {
-            *out++ = stack[num_decoded - j - 1];
-        }
+        std::reverse(out_start, out);
     }
 
     uint32_t decode(
         uint64_t& state, const uint8_t*& in8, size_t& enc_size) const
     {
         uint64_t state_mod_M = state & mask_M;
-        const auto& entry = dec_table[state_mod_M];
+        const auto entry = dec_table.lookup(state_mod_M, norm_mags);
         uint32_t sym = entry.sym;
         uint64_t f = entry.freq;
         state = f * (state >> log2_M) + entry.offset;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "ans-constants.hpp"
+#include "ans-stats.hpp"
 #include "ans-util.hpp"
 
 using mag_table = std::array<uint64_t, constants::MAX_MAG + 1>;
@@ -11,6 +12,7 @@ public:
     std::vector<uint32_t> normalized_freqs;
     std::vector<uint64_t> base;
     std::vector<uint64_t> sym_upper_bound;
+    std::array<ans_reciprocal, constants::MAX_MAG + 1> rcp_mags;
     mag_table norm_mags = { { 0 } };
     uint8_t log2_M = 0;
     uint64_t mask_M = 0;
@@ -75,6 +77,10 @@ public:
                 base[j] = cumsum;
                 cumsum += normalized_freqs[j];
             }
+            // all values of a magnitude share a freq and so a reciprocal.
+            // take the freq as stored in the table, which the coder uses
+            if (min_val <= max_val && normalized_freqs[min_val] != 0)
+                rcp_mags[i] = ans_reciprocal(normalized_freqs[min_val]);
         }
         M = cumsum;
         norm_lower_bound = constants::OUTPUT_BASE * M;
@@ -110,8 +116,9 @@ public:
             state = state >> constants::OUTPUT_BASE_LOG2;
         }
 
-        // (2) transform state
-        uint64_t next = ((state / f) * M) + (state % f) + b;
+        // (2) transform state. q = state / f without a division
+        uint64_t q = rcp_mags[ans_magnitude(num)].div(state);
+        uint64_t next = (q * M) + (state - q * f) + b;
         return next;
     }
 
@@ -157,21 +164,18 @@ public:
 
     void decode_u64(uint64_t state, uint32_t*& out) const
     {
-        static std::vector<uint32_t> stack(constants::MAXSTACKSIZE);
-        size_t num_decoded = 0;
+        auto out_start = out;
         while (state > 0) {
             uint64_t r = 1ULL + ((state - 1ULL) & mask_M);
             uint64_t j = (state - r) >> log2_M;
             uint32_t num = csum2sym[r - 1];
             uint64_t f = normalized_freqs[num];
             uint64_t b = base[num] + 1;
-            stack[num_decoded++] = num;
+            *out++ = num;
             state = f * j + r - b;
         }
         // (2a) output order in reverse decoding order
-        for (size_t j = 0; j < num_decoded; j++) {
-            *out++ = stack[num_decoded - j - 1];
-        }
+        std::reverse(out_start, out);
     }
 
     uint32_t decode(
@@ -182,10 +186,12 @@ public:
         uint64_t f = normalized_freqs[sym];
         uint64_t b = base[sym];
         state = f * (state >> log2_M) + state_mod_M - b;
+        ANS_STAT_ADD(mag_syms, 1);
         while (enc_size && state < norm_lower_bound) {
             uint8_t new_byte = *in8++;
             state = (state << constants::OUTPUT_BASE_LOG2) | uint64_t(new_byte);
             enc_size--;
+            ANS_STAT_ADD(mag_renorm_bytes, 1);
         }
         return sym;
     }
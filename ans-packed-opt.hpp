@@ -0,0 +1,218 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <limits>
+
+#include "ans-packed.hpp"
+
+/* ans_packed with variable block sizes. the models are trained on fixed
+   blocks of t_bs exactly like ans_packed<t_bs>. the encoder then splits
+   the list into blocks of t_max_bs, builds a binary tree over each down to
+   blocks of t_min_bs and picks, bottom up, whether a node is coded as one
+   block (with the model costing the fewest estimated bits) or as its two
+   children. this is linear in the list length. each block is stored as a
+   byte holding the model id and log2 of the block size followed by the
+   block itself; the last block of a list is cut at the end of the list */
+template <uint32_t t_bs = 128, uint32_t t_min_bs = 8,
+    uint32_t t_max_bs = 1024>
+struct ans_packed_opt {
+    static_assert((t_max_bs & (t_max_bs - 1)) == 0
+            && (t_min_bs & (t_min_bs - 1)) == 0 && t_min_bs != 0
+            && t_min_bs <= t_max_bs && t_max_bs <= (1 << 15),
+        "block sizes have to be powers of 2 of at most 2^15");
+
+private:
+    using fixed_codec = ans_packed<t_bs>;
+    static const size_t num_leaves = t_max_bs / t_min_bs;
+    /* estimated bits of a block beyond the cost of its values. every block
+       starts with its type byte. an ANS coded block adds its encoding size,
+       a vbyte of one byte for blocks under 128 bytes, and the final
+       state. the state holds the information of the last values, so only
+       what its vbyte adds counts: a bit per 7 plus rounding up to whole
+       bytes, taken as one byte */
+    static constexpr float block_byte_bits = 8;
+    static constexpr float enc_size_bits = 8;
+    static constexpr float flush_bits = 8;
+    static constexpr float uniform_block_bits = block_byte_bits;
+    static constexpr float ans_block_bits
+        = block_byte_bits + enc_size_bits + flush_bits;
+
+    struct node {
+        std::array<uint32_t, constants::MAX_MAG + 1> mags;
+        uint32_t max_val;
+        uint32_t len;
+        float bits;
+        uint8_t model_id;
+        bool split;
+    };
+
+public:
+    struct workspace {
+        /* the tree over one piece of t_max_bs values with num_leaves
+           leaves of t_min_bs values. node 1 is the root and node i has
+           the children 2i and 2i+1 */
+        std::array<node, 2 * num_leaves> tree;
+        std::array<uint8_t, t_max_bs * 8> tmp_out_buf;
+    };
+
+private:
+    fixed_codec fixed;
+    /* bits model m spends on a value of magnitude h */
+    std::array<std::array<float, constants::MAX_MAG + 1>, constants::NUM_MAGS>
+        bit_costs;
+    workspace ws;
+
+    /* pick the cheapest model able to code all values of the node */
+    void cost_block(node& nd) const
+    {
+        nd.bits = std::numeric_limits<float>::infinity();
+        nd.model_id = 0;
+        if (nd.max_val == 1) {
+            nd.bits = uniform_block_bits;
+            return;
+        }
+        uint8_t max_mag = ans_magnitude(nd.max_val);
+        for (size_t m = constants::MAG2SEL[max_mag]; m < constants::NUM_MAGS;
+             m++) {
+            if (nd.max_val > fixed.model(m).total_max_val)
+                continue;
+            float bits = ans_block_bits;
+            for (size_t h = 0; h <= max_mag; h++) {
+                if (nd.mags[h] != 0)
+                    bits += nd.mags[h] * bit_costs[m][h];
+            }
+            if (bits < nd.bits) {
+                nd.bits = bits;
+                nd.model_id = m;
+            }
+        }
+    }
+
+    /* emit the blocks of the subtree of node i starting at in. size is the
+       block size of the node, only the last block of a list is shorter */
+    uint8_t* encode_tree(const node* tree, size_t i, size_t size,
+        const uint32_t* in, uint8_t* out8,
+        std::array<uint8_t, t_max_bs * 8>& tmp_out_buf) const
+    {
+        const auto& nd = tree[i];
+        if (nd.len == 0)
+            return out8;
+        if (nd.split) {
+            out8 = encode_tree(tree, 2 * i, size / 2, in, out8, tmp_out_buf);
+            return encode_tree(
+                tree, 2 * i + 1, size / 2, in + size / 2, out8, tmp_out_buf);
+        }
+        ANS_STAT_ADD(packed_models[nd.model_id], 1);
+        *out8++ = (nd.model_id << 4) | bits::hi(size);
+        return fixed.encode_block(nd.model_id, in, nd.len, out8, tmp_out_buf);
+    }
+
+public:
+    bool required_increasing = false;
+    std::string name()
+    {
+        return "ans_packed_opt_B" + std::to_string(t_bs) + "_m"
+            + std::to_string(t_min_bs) + "_M" + std::to_string(t_max_bs);
+    }
+
+    void init(const list_data& input, uint32_t* out, size_t& nvalue)
+    {
+        // (1) train the models on fixed blocks
+        fixed.init(input, out, nvalue);
+
+        // (2) and derive the cost of each magnitude under each model. all
+        // values of a magnitude share one frequency
+        for (size_t m = 0; m < constants::NUM_MAGS; m++) {
+            const auto& model = fixed.model(m);
+            for (size_t h = 0; h <= constants::MAX_MAG; h++) {
+                const auto& freqs = model.normalized_freqs;
+                uint32_t v = ans_min_val_in_mag(h);
+                bit_costs[m][h] = std::numeric_limits<float>::infinity();
+                if (v <= model.total_max_val && freqs[v] != 0)
+                    bit_costs[m][h] = std::log2(double(model.M) / freqs[v]);
+            }
+        }
+    }
+
+    const uint32_t* dec_init(const uint32_t* in) { return fixed.dec_init(in); }
+
+    void encodeArray(
+        const uint32_t* in, const size_t len, uint32_t* out, size_t& nvalue)
+    {
+        encodeArray(in, len, out, nvalue, ws);
+    }
+    void encodeArray(const uint32_t* in, const size_t len, uint32_t* out,
+        size_t& nvalue, workspace& w) const
+    {
+        auto initout8 = reinterpret_cast<uint8_t*>(out);
+        auto out8 = initout8;
+        auto& tree = w.tree;
+        for (size_t start = 0; start < len; start += t_max_bs) {
+            // (1) fill the leaves
+            for (size_t i = 0; i < num_leaves; i++) {
+                auto& nd = tree[num_leaves + i];
+                size_t leaf_start = std::min(start + i * t_min_bs, len);
+                size_t leaf_end = std::min(leaf_start + t_min_bs, len);
+                nd.mags.fill(0);
+                nd.max_val = 0;
+                nd.len = leaf_end - leaf_start;
+                nd.split = false;
+                for (size_t k = leaf_start; k < leaf_end; k++) {
+                    nd.mags[ans_magnitude(in[k])]++;
+                    nd.max_val = std::max(nd.max_val, in[k]);
+                }
+                if (nd.len != 0)
+                    cost_block(nd);
+            }
+
+            // (2) merge bottom up, keeping the children if cheaper
+            for (size_t i = num_leaves - 1; i != 0; i--) {
+                auto& nd = tree[i];
+                const auto& l = tree[2 * i];
+                const auto& r = tree[2 * i + 1];
+                nd.len = l.len + r.len;
+                nd.max_val = std::max(l.max_val, r.max_val);
+                for (size_t h = 0; h < nd.mags.size(); h++)
+                    nd.mags[h] = l.mags[h] + r.mags[h];
+                if (nd.len == 0)
+                    continue;
+                cost_block(nd);
+                float split_bits = l.bits + (r.len != 0 ? r.bits : 0);
+                nd.split = split_bits < nd.bits;
+                if (nd.split)
+                    nd.bits = split_bits;
+            }
+
+            // (3) encode the chosen blocks
+            out8 = encode_tree(
+                tree.data(), 1, t_max_bs, in + start, out8, w.tmp_out_buf);
+        }
+
+        // (4) align to u32 boundary
+        size_t wb = out8 - initout8;
+        if (wb % sizeof(uint32_t) != 0) {
+            wb += sizeof(uint32_t) - (wb % (sizeof(uint32_t)));
+        }
+        nvalue = wb / sizeof(uint32_t);
+    }
+    uint32_t* decodeArray(
+        const uint32_t* in, const size_t len, uint32_t* out, size_t list_len)
+    {
+        return decodeArray(in, len, out, list_len, ws);
+    }
+    uint32_t* decodeArray(const uint32_t* in, const size_t, uint32_t* out,
+        size_t list_len, workspace&) const
+    {
+        auto in8 = reinterpret_cast<const uint8_t*>(in);
+        size_t pos = 0;
+        while (pos < list_len) {
+            uint8_t block_type = *in8++;
+            size_t block_size = std::min(
+                size_t(1) << (block_type & 15), list_len - pos);
+            out = fixed.decode_block(block_type >> 4, in8, block_size, out);
+            pos += block_size;
+        }
+        return out;
+    }
+};
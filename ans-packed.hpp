@@ -7,10 +7,23 @@
 #include "ans-util.hpp"
 #include "util.hpp"
 
-template <uint32_t t_bs = 8> struct ans_packed {
+/* with t_skips set every list stores a skip table after the block types:
+   the byte offset of each block but the first relative to the first block
+   and the running sum of the list up to the end of each block (the last
+   docid of the block for d-gap lists), all as u32s. any block can then be
+   located and decoded on its own */
+template <uint32_t t_bs = 8, bool t_skips = false> struct ans_packed {
+public:
+    /* the model id of each block and the reversed output of one block */
+    struct workspace {
+        std::vector<uint8_t> block_models;
+        std::array<uint8_t, t_bs * 8> tmp_out_buf;
+    };
+
 private:
     std::vector<ans_mag_model> models;
-    uint8_t pick_model(const uint32_t* in, size_t n)
+    workspace ws;
+    uint8_t pick_model(const uint32_t* in, size_t n) const
     {
         uint8_t max_mag = 0;
         for (size_t i = 0; i < n; i++) {
@@ -19,41 +32,84 @@ private:
         return constants::MAG2SEL[max_mag];
     }
 
+    static uint32_t load_u32(const uint8_t* in8)
+    {
+        uint32_t x;
+        memcpy(&x, in8, sizeof(uint32_t));
+        return x;
+    }
+    static void store_u32(uint8_t* out8, uint32_t x)
+    {
+        memcpy(out8, &x, sizeof(uint32_t));
+    }
+
 public:
     bool required_increasing = false;
-    std::string name() { return "ans_packed_B" + std::to_string(t_bs); }
+    std::string name()
+    {
+        return "ans_packed_B" + std::to_string(t_bs) + (t_skips ? "_S" : "");
+    }
     const uint32_t bs = t_bs;
 
+    static size_t num_blocks(size_t list_len)
+    {
+        return (list_len + t_bs - 1) / t_bs;
+    }
+    /* bytes of the skip table of a list of list_len elements */
+    static size_t skip_table_bytes(size_t list_len)
+    {
+        size_t n = num_blocks(list_len);
+        if (!t_skips || n == 0)
+            return 0;
+        return (2 * n - 1) * sizeof(uint32_t);
+    }
+
 public:
     void init(const list_data& input, uint32_t* out, size_t& nvalue)
     {
-        // (1) count frequencies for each model
-        std::vector<mag_table> mags(constants::NUM_MAGS);
-        for (auto& mt : mags)
+        // (1) count frequencies for each model on multiple threads
+        struct packed_stats {
+            std::vector<mag_table> mags;
+            std::vector<uint32_t> max_vals;
+        };
+        packed_stats init_stats{ std::vector<mag_table>(constants::NUM_MAGS),
+            std::vector<uint32_t>(constants::NUM_MAGS, 0) };
+        for (auto& mt : init_stats.mags)
             mt.fill(0);
+        auto part_stats = parallel_list_stats(input, init_stats,
+            [this](packed_stats& st, const uint32_t* cur_list, size_t n) {
+                size_t last_block_size = n % t_bs;
+                size_t num_blocks = n / t_bs + (last_block_size != 0);
+                last_block_size
+                    = last_block_size == 0 ? t_bs : last_block_size;
 
-        std::vector<uint32_t> max_vals(constants::NUM_MAGS, 0);
-        for (size_t i = 0; i < input.num_lists; i++) {
-            const auto& cur_list = input.list_ptrs[i];
-            size_t n = input.list_sizes[i];
-            size_t last_block_size = n % t_bs;
-            size_t num_blocks = n / t_bs + (last_block_size != 0);
-            last_block_size = last_block_size == 0 ? t_bs : last_block_size;
-
-            // (1a) for each block
-            for (size_t j = 0; j < num_blocks; j++) {
-                size_t block_offset = j * t_bs;
-                size_t block_size = t_bs;
-                if (j + 1 == num_blocks)
-                    block_size = last_block_size;
-
-                auto model_id = pick_model(cur_list + block_offset, block_size);
-                for (size_t k = 0; k < block_size; k++) {
-                    uint32_t num = cur_list[block_offset + k];
-                    uint8_t mag = ans_magnitude(num);
-                    max_vals[model_id] = std::max(num, max_vals[model_id]);
-                    mags[model_id][mag]++;
+                // (1a) for each block
+                for (size_t j = 0; j < num_blocks; j++) {
+                    size_t block_offset = j * t_bs;
+                    size_t block_size = t_bs;
+                    if (j + 1 == num_blocks)
+                        block_size = last_block_size;
+
+                    auto model_id
+                        = pick_model(cur_list + block_offset, block_size);
+                    auto& max_val = st.max_vals[model_id];
+                    for (size_t k = 0; k < block_size; k++) {
+                        uint32_t num = cur_list[block_offset + k];
+                        uint8_t mag = ans_magnitude(num);
+                        max_val = std::max(num, max_val);
+                        st.mags[model_id][mag]++;
+                    }
                 }
+            });
+
+        // (1b) merge the per thread counts
+        auto& mags = init_stats.mags;
+        auto& max_vals = init_stats.max_vals;
+        for (const auto& st : part_stats) {
+            for (size_t m = 0; m < constants::NUM_MAGS; m++) {
+                max_vals[m] = std::max(max_vals[m], st.max_vals[m]);
+                for (size_t k = 0; k < mags[m].size(); k++)
+                    mags[m][k] += st.mags[m][k];
             }
         }
 
@@ -96,13 +152,18 @@ public:
 
     void encodeArray(
         const uint32_t* in, const size_t len, uint32_t* out, size_t& nvalue)
+    {
+        encodeArray(in, len, out, nvalue, ws);
+    }
+    void encodeArray(const uint32_t* in, const size_t len, uint32_t* out,
+        size_t& nvalue, workspace& w) const
     {
         size_t left = len % t_bs;
         size_t num_blocks = len / t_bs + (left != 0);
         size_t last_block_size = left == 0 ? t_bs : left;
 
         // (1) determine block models
-        static std::vector<uint8_t> block_models;
+        auto& block_models = w.block_models;
         if (block_models.size() < num_blocks + 1) {
             block_models.resize(num_blocks + 1);
         }
@@ -113,7 +174,10 @@ public:
                 block_size = last_block_size;
             auto model_id = pick_model(in + block_offset, block_size);
             block_models[j] = model_id;
+            ANS_STAT_ADD(packed_models[model_id], 1);
         }
+        // unused low nibble of the last block type byte
+        block_models[num_blocks] = 0;
         // (2) encode block types
         auto initout8 = reinterpret_cast<uint8_t*>(out);
         auto out8 = initout8;
@@ -123,10 +187,17 @@ public:
             *out8++ = packed_block_types;
         }
 
+        // (2a) leave room for the skip table. it is filled in below
+        uint8_t* skip_offsets = out8;
+        uint8_t* skip_lasts = out8;
+        if (t_skips && num_blocks != 0)
+            skip_lasts += (num_blocks - 1) * sizeof(uint32_t);
+        out8 += skip_table_bytes(len);
+        auto blocks8 = out8;
+
         // (3) perform actual encoding
-        static int list_id = 0;
-        list_id++;
-        static std::array<uint8_t, t_bs * 8> tmp_out_buf;
+        auto& tmp_out_buf = w.tmp_out_buf;
+        uint32_t last = 0;
         for (size_t j = 0; j < num_blocks; j++) {
             auto model_id = block_models[j];
             size_t block_offset = j * t_bs;
@@ -134,27 +205,19 @@ public:
             if (j + 1 == num_blocks)
                 block_size = last_block_size;
 
-            if (model_id == 0) { // all 1s. continue
-                continue;
-            }
-
-            // reverse encode the block using the selected ANS model
-            const auto& cur_model = models[model_id];
-            uint64_t state = constants::ANS_START_STATE;
-            auto out_ptr = tmp_out_buf.data() + tmp_out_buf.size() - 1;
-            auto out_start = out_ptr;
-            for (size_t k = 0; k < block_size; k++) {
-                uint32_t num = in[block_offset + block_size - k - 1];
-                state = cur_model.encode(state, num, out_ptr);
+            if (t_skips) {
+                if (j != 0) {
+                    store_u32(skip_offsets + (j - 1) * sizeof(uint32_t),
+                        out8 - blocks8);
+                }
+                for (size_t k = 0; k < block_size; k++) {
+                    last += in[block_offset + k];
+                }
+                store_u32(skip_lasts + j * sizeof(uint32_t), last);
             }
-            cur_model.flush(state, out_ptr);
-
-            // output the encoding
-            size_t enc_size = (out_start - out_ptr);
-            ans_vbyte_encode_u64(out8, enc_size);
-            memcpy(out8, out_ptr, enc_size);
 
-            out8 += enc_size;
+            out8 = encode_block(
+                model_id, in + block_offset, block_size, out8, tmp_out_buf);
         }
         // (4) align to u32 boundary
         size_t wb = out8 - initout8;
@@ -165,12 +228,17 @@ public:
     }
     uint32_t* decodeArray(
         const uint32_t* in, const size_t len, uint32_t* out, size_t list_len)
+    {
+        return decodeArray(in, len, out, list_len, ws);
+    }
+    uint32_t* decodeArray(const uint32_t* in, const size_t, uint32_t* out,
+        size_t list_len, workspace& w) const
     {
         size_t left = list_len % t_bs;
         size_t num_blocks = list_len / t_bs + (left != 0);
         size_t last_block_size = left == 0 ? t_bs : left;
 
-        static std::vector<uint8_t> block_models;
+        auto& block_models = w.block_models;
         if (block_models.size() < (num_blocks + 1)) {
             block_models.resize(num_blocks + 1);
         }
@@ -183,30 +251,118 @@ public:
             block_models[i] = packed_block_types >> 4;
             block_models[i + 1] = packed_block_types & 15;
         }
-
-        int list_id = 0;
-        list_id++;
+        in8 += skip_table_bytes(list_len);
 
         // (2) perform actual decoding
         for (size_t j = 0; j < num_blocks; j++) {
-            auto model_id = block_models[j];
             size_t block_size = t_bs;
             if (j + 1 == num_blocks)
                 block_size = last_block_size;
+            out = decode_block(block_models[j], in8, block_size, out);
+        }
+        return out;
+    }
 
-            if (model_id == 0) { // uniform block
-                for (size_t k = 0; k < block_size; k++) {
-                    *out++ = 1;
-                }
-                continue;
-            }
-            const auto& model = models[model_id];
-            size_t enc_size = ans_vbyte_decode_u64(in8);
-            uint64_t state = model.init_decoder(in8, enc_size);
+public:
+    /* the trained model of block type model_id */
+    const ans_mag_model& model(uint8_t model_id) const
+    {
+        return models[model_id];
+    }
+    /* encode the block_size values at in with model_id to out8 and return
+       the end of the output. uniform blocks take no space */
+    template <size_t t_buf_size>
+    uint8_t* encode_block(uint8_t model_id, const uint32_t* in,
+        size_t block_size, uint8_t* out8,
+        std::array<uint8_t, t_buf_size>& tmp_out_buf) const
+    {
+        if (model_id == 0) { // all 1s
+            return out8;
+        }
+
+        // reverse encode the block using the selected ANS model
+        const auto& cur_model = models[model_id];
+        uint64_t state = constants::ANS_START_STATE;
+        auto out_ptr = tmp_out_buf.data() + tmp_out_buf.size() - 1;
+        auto out_start = out_ptr;
+        for (size_t k = 0; k < block_size; k++) {
+            uint32_t num = in[block_size - k - 1];
+            state = cur_model.encode(state, num, out_ptr);
+        }
+        cur_model.flush(state, out_ptr);
+
+        // output the encoding
+        size_t enc_size = (out_start - out_ptr);
+        ans_vbyte_encode_u64(out8, enc_size);
+        memcpy(out8, out_ptr, enc_size);
+        return out8 + enc_size;
+    }
+    /* decode a block of block_size values coded with model_id starting at
+       in8 and move in8 past it */
+    uint32_t* decode_block(uint8_t model_id, const uint8_t*& in8,
+        size_t block_size, uint32_t* out) const
+    {
+        if (model_id == 0) { // uniform block
+            ANS_STAT_ADD(packed_uniform_blocks, 1);
             for (size_t k = 0; k < block_size; k++) {
-                *out++ = model.decode(state, in8, enc_size);
+                *out++ = 1;
             }
+            return out;
+        }
+        const auto& model = models[model_id];
+        size_t enc_size = ans_vbyte_decode_u64(in8);
+        uint64_t state = model.init_decoder(in8, enc_size);
+        for (size_t k = 0; k < block_size; k++) {
+            *out++ = model.decode(state, in8, enc_size);
         }
         return out;
     }
+
+    /* block level access to a list encoded with skips */
+    struct skip_list {
+        const uint8_t* block_types;
+        const uint8_t* offsets;
+        const uint8_t* lasts;
+        const uint8_t* blocks;
+        size_t num_blocks;
+        size_t list_len;
+    };
+
+    static skip_list read_skips(const uint32_t* in, size_t list_len)
+    {
+        static_assert(t_skips, "ans_packed lists carry no skip table");
+        skip_list sl;
+        sl.num_blocks = num_blocks(list_len);
+        sl.list_len = list_len;
+        sl.block_types = reinterpret_cast<const uint8_t*>(in);
+        sl.offsets = sl.block_types + (sl.num_blocks + 1) / 2;
+        sl.lasts = sl.offsets;
+        if (sl.num_blocks != 0)
+            sl.lasts += (sl.num_blocks - 1) * sizeof(uint32_t);
+        sl.blocks = sl.offsets + skip_table_bytes(list_len);
+        return sl;
+    }
+    static size_t block_size(const skip_list& sl, size_t j)
+    {
+        return j + 1 == sl.num_blocks ? sl.list_len - j * t_bs : t_bs;
+    }
+    /* running sum of the list up to and including the last element of
+       block j */
+    static uint32_t block_last(const skip_list& sl, size_t j)
+    {
+        return load_u32(sl.lasts + j * sizeof(uint32_t));
+    }
+    /* decode block j of the list into out and return the end of the output.
+       the values are the encoded ones, so d-gaps for docid lists */
+    uint32_t* decode_block(const skip_list& sl, size_t j, uint32_t* out) const
+    {
+        uint8_t packed_block_types = sl.block_types[j / 2];
+        uint8_t model_id
+            = (j % 2 == 0) ? packed_block_types >> 4 : packed_block_types & 15;
+        const uint8_t* in8 = sl.blocks;
+        if (j != 0) {
+            in8 += load_u32(sl.offsets + (j - 1) * sizeof(uint32_t));
+        }
+        return decode_block(model_id, in8, block_size(sl, j), out);
+    }
 };
@@ -12,20 +12,26 @@ const uint64_t WINDOW = 65; /* should be odd */
 const uint64_t PAYLOADBITS = 64;
 }
 
-using ans_model_type = ans_mag_model_fast;
-
 struct enc_res {
     uint8_t model_id;
     uint64_t span;
     uint64_t word;
 };
 
-struct ans_simple {
+template <class t_model = ans_mag_model_fast<> > struct ans_simple {
+public:
+    /* the model id of each word and the encoded words */
+    struct workspace {
+        std::vector<uint8_t> selectors;
+        std::vector<uint64_t> encoded_data;
+    };
+
 private:
-    std::vector<ans_model_type> models;
+    std::vector<t_model> models;
+    workspace ws;
 
 private:
-    enc_res pick_model(const uint32_t* in, size_t n)
+    enc_res pick_model(const uint32_t* in, size_t n) const
     {
         uint8_t best_model = 0;
         uint64_t best_span = 0;
@@ -44,107 +50,125 @@ private:
 
 public:
     bool required_increasing = false;
-    std::string name() { return "ans_simple"; }
+    std::string name() { return "ans_simple" + t_model::name_suffix(); }
 public:
     void init(const list_data& input, uint32_t* out, size_t& nvalue)
     {
-        // (1) count frequencies for each model
-        std::vector<uint8_t> M(4096 * constants::WINDOW, 0);
-        std::vector<mag_table> L(constants::NUM_MAGS);
-        for (auto& mt : L)
+        // (1) count frequencies for each model. the window restarts at
+        // each list so every thread slides its own window over its lists
+        struct simple_stats {
+            std::vector<uint8_t> M;
+            std::vector<mag_table> L;
+            uint32_t max_val;
+        };
+        simple_stats init_stats{
+            std::vector<uint8_t>(4096 * constants::WINDOW, 0),
+            std::vector<mag_table>(constants::NUM_MAGS), 0
+        };
+        for (auto& mt : init_stats.L)
             mt.fill(0);
-        uint32_t max_val = 0;
-        for (size_t i = 0; i < input.num_lists; i++) {
-            const auto& cur_list = input.list_ptrs[i];
-            size_t n = input.list_sizes[i];
-            size_t pos = 0;
+        auto part_stats = parallel_list_stats(input, init_stats,
+            [](simple_stats& st, const uint32_t* cur_list, size_t n) {
+                size_t pos = 0;
 
-            /* (nearly) fill the window and get ready for steady-state
-             * processing */
-            for (pos = 0; pos < constants::WINDOW; pos++) {
-                auto next = cur_list[pos];
-                if (next > max_val) {
-                    max_val = next;
+                /* (nearly) fill the window and get ready for steady-state
+                 * processing */
+                for (pos = 0; pos < constants::WINDOW && pos < n; pos++) {
+                    auto next = cur_list[pos];
+                    if (next > st.max_val) {
+                        st.max_val = next;
+                    }
+                    st.M[pos] = ans_magnitude(next);
                 }
-                M[pos] = ans_magnitude(next);
-            }
 
-            /* get a new "final" element in to the window */
-            size_t off = 0;
-            while (pos < n) {
                 /* get a new "final" element in to the window */
-                auto next = cur_list[pos];
-                M[off + constants::WINDOW - 1] = ans_magnitude(next);
-                if (next > max_val) {
-                    max_val = next;
-                }
-                auto mid = constants::WINDOW / 2;
-                auto mag = M[off + mid];
-                uint8_t ocen = M[off + mid], olft = M[off + mid],
-                        orgt = M[off + mid];
-                /* try to the left first */
-                for (uint64_t stp = 1; stp <= constants::WINDOW / 2; stp++) {
-                    uint8_t nlft = olft;
-                    if (nlft < M[off + mid - stp]) {
-                        nlft = M[off + mid - stp];
+                size_t off = 0;
+                while (pos < n) {
+                    /* get a new "final" element in to the window */
+                    auto next = cur_list[pos];
+                    st.M[off + constants::WINDOW - 1] = ans_magnitude(next);
+                    if (next > st.max_val) {
+                        st.max_val = next;
                     }
-                    if (nlft * (stp + 1) > constants::PAYLOADBITS) {
-                        /* time to stop */
-                        break;
+                    auto mid = constants::WINDOW / 2;
+                    auto mag = st.M[off + mid];
+                    uint8_t ocen = st.M[off + mid], olft = st.M[off + mid],
+                            orgt = st.M[off + mid];
+                    /* try to the left first */
+                    for (uint64_t stp = 1; stp <= constants::WINDOW / 2;
+                         stp++) {
+                        uint8_t nlft = olft;
+                        if (nlft < st.M[off + mid - stp]) {
+                            nlft = st.M[off + mid - stp];
+                        }
+                        if (nlft * (stp + 1) > constants::PAYLOADBITS) {
+                            /* time to stop */
+                            break;
+                        }
+                        olft = nlft;
                     }
-                    olft = nlft;
-                }
-                /* try to the right next */
-                for (uint64_t stp = 1; stp <= constants::WINDOW / 2; stp++) {
-                    uint8_t nrgt = orgt;
-                    if (nrgt < M[off + mid + stp]) {
-                        nrgt = M[off + mid + stp];
+                    /* try to the right next */
+                    for (uint64_t stp = 1; stp <= constants::WINDOW / 2;
+                         stp++) {
+                        uint8_t nrgt = orgt;
+                        if (nrgt < st.M[off + mid + stp]) {
+                            nrgt = st.M[off + mid + stp];
+                        }
+                        if (nrgt * (stp + 1) > constants::PAYLOADBITS) {
+                            /* time to stop */
+                            break;
+                        }
+                        orgt = nrgt;
                     }
-                    if (nrgt * (stp + 1) > constants::PAYLOADBITS) {
-                        /* time to stop */
-                        break;
+                    /* and then symmetric about the middle */
+                    for (uint64_t stp = 1; stp <= constants::WINDOW / 2;
+                         stp++) {
+                        uint8_t ncen = ocen;
+                        if (ncen < st.M[off + mid - stp]) {
+                            ncen = st.M[off + mid - stp];
+                        }
+                        if (ncen < st.M[off + mid + stp]) {
+                            ncen = st.M[off + mid + stp];
+                        }
+                        if (ncen * (2 * stp + 1) >= constants::PAYLOADBITS) {
+                            /* end of the line */
+                            break;
+                        }
+                        ocen = ncen;
                     }
-                    orgt = nrgt;
-                }
-                /* and then symmetric about the middle */
-                for (uint64_t stp = 1; stp <= constants::WINDOW / 2; stp++) {
-                    uint8_t ncen = ocen;
-                    if (ncen < M[off + mid - stp]) {
-                        ncen = M[off + mid - stp];
-                    }
-                    if (ncen < M[off + mid + stp]) {
-                        ncen = M[off + mid + stp];
-                    }
-                    if (ncen * (2 * stp + 1) >= constants::PAYLOADBITS) {
-                        /* end of the line */
-                        break;
-                    }
-                    ocen = ncen;
-                }
-                /* select the median */
-                auto med = ans_median(olft, ocen, orgt);
+                    /* select the median */
+                    auto med = ans_median(olft, ocen, orgt);
 
-                auto big = constants::MAG2SEL[med];
-                L[big][mag]++;
+                    auto big = constants::MAG2SEL[med];
+                    st.L[big][mag]++;
 
-                /* and then copy down and move pos ahead*/
-                if ((off + constants::WINDOW + 1) >= M.size()) {
-                    for (uint64_t i = 1; i < constants::WINDOW; i++) {
-                        M[i - 1] = M[off + i];
+                    /* and then copy down and move pos ahead*/
+                    if ((off + constants::WINDOW + 1) >= st.M.size()) {
+                        for (uint64_t i = 1; i < constants::WINDOW; i++) {
+                            st.M[i - 1] = st.M[off + i];
+                        }
+                        off = 0;
+                    } else {
+                        off++;
                     }
-                    off = 0;
-                } else {
-                    off++;
+                    pos++;
                 }
-                pos++;
+            });
+
+        // (1b) merge the per thread counts
+        auto& L = init_stats.L;
+        uint32_t max_val = 0;
+        for (const auto& st : part_stats) {
+            max_val = std::max(max_val, st.max_val);
+            for (size_t m = 0; m < constants::NUM_MAGS; m++) {
+                for (size_t k = 0; k < L[m].size(); k++)
+                    L[m][k] += st.L[m][k];
             }
         }
         fprintf(stderr, "gather stats done.\n");
 
-        // (2) create the models
+        // (2) ensure each model can encode everything up 2 its max_mag
         for (uint8_t i = 0; i < constants::NUM_MAGS; i++) {
-            auto maxv = ans_max_val_in_mag(constants::SEL2MAG[i], max_val);
-            // (2a) ensure we can encode everything up 2 max_mag
             uint8_t max_mag = 0;
             for (size_t j = 0; j < L[i].size(); j++) {
                 if (L[i][j] != 0)
@@ -156,6 +180,29 @@ public:
                         L[i][j] = 1;
                 }
             }
+        }
+
+        // (2a) the window never centers on the ends of a list, so a
+        // magnitude seen only there is in no model. the widest model takes
+        // those, otherwise such values could not be encoded at all
+        auto& widest = L[constants::NUM_MAGS - 1];
+        for (uint8_t h = 0; h <= ans_magnitude(max_val); h++) {
+            bool covered = false;
+            for (uint8_t i = 0; i < constants::NUM_MAGS; i++) {
+                if (L[i][h] != 0 && h <= constants::SEL2MAG[i])
+                    covered = true;
+            }
+            if (!covered) {
+                for (uint8_t j = 0; j <= h; j++) {
+                    if (widest[j] == 0)
+                        widest[j] = 1;
+                }
+            }
+        }
+
+        // (3) create the models
+        for (uint8_t i = 0; i < constants::NUM_MAGS; i++) {
+            auto maxv = ans_max_val_in_mag(constants::SEL2MAG[i], max_val);
             fprintf(stderr, "create model %lu\n", models.size());
             models.emplace_back(L[i], maxv);
         }
@@ -182,7 +229,7 @@ public:
         auto initin8 = reinterpret_cast<const uint8_t*>(in);
         auto in8 = initin8;
         for (uint8_t i = 0; i < constants::NUM_MAGS; i++) {
-            models.emplace_back(ans_model_type(in8));
+            models.emplace_back(t_model(in8));
         }
         size_t pbytes = in8 - initin8;
         if (pbytes % sizeof(uint32_t) != 0) {
@@ -194,12 +241,19 @@ public:
 
     void encodeArray(
         const uint32_t* in, const size_t len, uint32_t* out, size_t& nvalue)
+    {
+        encodeArray(in, len, out, nvalue, ws);
+    }
+    void encodeArray(const uint32_t* in, const size_t len, uint32_t* out,
+        size_t& nvalue, workspace& w) const
     {
         // fprintf(stderr, "encodeArray START\n");
-        static std::vector<uint8_t> model_ids;
-        static std::vector<uint64_t> encoded_data;
+        auto& model_ids = w.selectors;
+        auto& encoded_data = w.encoded_data;
         if (model_ids.size() < (len + 1)) {
             model_ids.resize(len + 1);
+        }
+        if (encoded_data.size() < (len + 1)) {
             encoded_data.resize(len + 1);
         }
 
@@ -210,8 +264,11 @@ public:
             auto enc_res = pick_model(in + pos, remaining);
             model_ids[words_written] = enc_res.model_id;
             encoded_data[words_written++] = enc_res.word;
+            ANS_STAT_ADD(simple_spans[enc_res.span], 1);
             pos += enc_res.span;
         }
+        // unused low nibble of the last selector byte
+        model_ids[words_written] = 0;
 
         // (3) write to output
         auto initout8 = reinterpret_cast<uint8_t*>(out);
@@ -239,13 +296,18 @@ public:
     }
     uint32_t* decodeArray(
         const uint32_t* in, const size_t len, uint32_t* out, size_t list_len)
+    {
+        return decodeArray(in, len, out, list_len, ws);
+    }
+    uint32_t* decodeArray(const uint32_t* in, const size_t, uint32_t* out,
+        size_t, workspace& w) const
     {
         // fprintf(stderr, "decodeArray START\n");
         // (1) decode selectors
         auto initin8 = reinterpret_cast<const uint8_t*>(in);
         auto in8 = initin8;
         size_t num_sels = ans_vbyte_decode_u64(in8);
-        static std::vector<uint8_t> selectors;
+        auto& selectors = w.selectors;
         if (selectors.size() < (num_sels + 1)) {
             selectors.resize(num_sels + 1);
         }
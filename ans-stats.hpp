@@ -0,0 +1,85 @@
+#pragma once
+
+#include <array>
+#include <cstdio>
+#include <string>
+
+#include "ans-constants.hpp"
+
+/* hot path counters of the ANS codecs. they are only collected when
+   compiled with -DANS_STATS. otherwise ANS_STAT_ADD expands to nothing and
+   the codecs are exactly the same code as without the counters */
+#ifdef ANS_STATS
+
+#include <atomic>
+
+struct ans_counters {
+    /* ans_byte_model::decode: symbols and renormalization bytes read */
+    std::atomic<uint64_t> byte_syms;
+    std::atomic<uint64_t> byte_renorm_bytes;
+    /* ans_mag_model::decode: symbols and renormalization bytes read */
+    std::atomic<uint64_t> mag_syms;
+    std::atomic<uint64_t> mag_renorm_bytes;
+    /* ans_packed: block models picked by the encoder and all-1 blocks the
+       decoder fills without decoding */
+    std::atomic<uint64_t> packed_models[constants::NUM_MAGS];
+    std::atomic<uint64_t> packed_uniform_blocks;
+    /* ans_simple: number of values packed into each 64 bit word */
+    std::atomic<uint64_t> simple_spans[65];
+};
+
+inline ans_counters& ans_stats()
+{
+    static ans_counters counters;
+    return counters;
+}
+
+#define ANS_STAT_ADD(counter, n)                                              \
+    ans_stats().counter.fetch_add(n, std::memory_order_relaxed)
+
+inline void ans_stats_reset()
+{
+    auto& c = ans_stats();
+    c.byte_syms = 0;
+    c.byte_renorm_bytes = 0;
+    c.mag_syms = 0;
+    c.mag_renorm_bytes = 0;
+    for (auto& x : c.packed_models)
+        x = 0;
+    c.packed_uniform_blocks = 0;
+    for (auto& x : c.simple_spans)
+        x = 0;
+}
+
+/* print the counters as one line. histograms are written as
+   value:count pairs of the non zero entries */
+inline void ans_stats_print(FILE* f, std::string name)
+{
+    auto& c = ans_stats();
+    fprintf(f, "stats %s;byte_syms=%lu;byte_renorm_bytes=%lu;mag_syms=%lu;"
+               "mag_renorm_bytes=%lu;packed_uniform_blocks=%lu;"
+               "packed_models=",
+        name.c_str(), c.byte_syms.load(), c.byte_renorm_bytes.load(),
+        c.mag_syms.load(), c.mag_renorm_bytes.load(),
+        c.packed_uniform_blocks.load());
+    for (size_t i = 0; i < constants::NUM_MAGS; i++) {
+        if (c.packed_models[i] != 0)
+            fprintf(f, "%lu:%lu,", i, c.packed_models[i].load());
+    }
+    fprintf(f, ";simple_spans=");
+    for (size_t i = 0; i < 65; i++) {
+        if (c.simple_spans[i] != 0)
+            fprintf(f, "%lu:%lu,", i, c.simple_spans[i].load());
+    }
+    fprintf(f, "\n");
+    fflush(f);
+}
+
+#else
+
+#define ANS_STAT_ADD(counter, n)
+
+inline void ans_stats_reset() {}
+inline void ans_stats_print(FILE*, std::string) {}
+
+#endif
@@ -0,0 +1,276 @@
+#pragma once
+
+#include <array>
+#include <immintrin.h>
+
+#include "ans-byte.hpp"
+#include "ans-constants.hpp"
+#include "ans-util.hpp"
+#include "util.hpp"
+
+/* stream vbyte lengths: x is stored in 1 to 4 little endian bytes */
+inline uint32_t ans_svbyte_len(uint32_t x)
+{
+    if (x < (1U << 8))
+        return 1;
+    if (x < (1U << 16))
+        return 2;
+    if (x < (1U << 24))
+        return 3;
+    return 4;
+}
+
+struct ans_svbyte_freqs {
+    freq_table ctrl;
+    std::array<freq_table, 4> data;
+};
+
+/* one control byte holds the 2 bit length codes (len-1) of a group of 4
+   values, value j in bits 2j and 2j+1. lists are padded with 0s to full
+   groups */
+inline void ans_svbyte_freq_count(
+    const uint32_t* in, size_t n, ans_svbyte_freqs& f)
+{
+    for (size_t i = 0; i < n; i += 4) {
+        uint32_t ctrl = 0;
+        for (size_t j = 0; j < 4; j++) {
+            uint32_t x = i + j < n ? in[i + j] : 0;
+            uint32_t len = ans_svbyte_len(x);
+            ctrl |= (len - 1) << (2 * j);
+            for (size_t k = 0; k < len; k++)
+                f.data[k][(x >> (8 * k)) & 0xFF]++;
+        }
+        f.ctrl[ctrl]++;
+    }
+}
+
+/* for each control byte: the pshufb mask moving the position streams
+   (4 bytes of each loaded side by side) into 4 u32s, and the number of
+   bytes the group takes from each position stream */
+struct ans_svbyte_group {
+    std::array<uint8_t, 16> shuf;
+    std::array<uint8_t, 4> counts;
+};
+
+inline const std::array<ans_svbyte_group, 256>& ans_svbyte_group_table()
+{
+    static const std::array<ans_svbyte_group, 256> table = [] {
+        std::array<ans_svbyte_group, 256> t;
+        for (uint32_t c = 0; c < 256; c++) {
+            auto& g = t[c];
+            g.counts.fill(0);
+            for (uint32_t j = 0; j < 4; j++) {
+                uint32_t len = ((c >> (2 * j)) & 3) + 1;
+                for (uint32_t k = 0; k < 4; k++) {
+                    if (k < len) {
+                        g.shuf[4 * j + k] = 4 * k + g.counts[k]++;
+                    } else {
+                        g.shuf[4 * j + k] = 0x80;
+                    }
+                }
+            }
+        }
+        return t;
+    }();
+    return table;
+}
+
+/* stream vbyte as an ANS front end. the control bytes are coded with
+   their own model and byte k of every value goes to position stream k
+   which has its own model as well, so the high bytes of large values do
+   not share statistics with the low bytes. decoding ANS decodes the
+   streams and reassembles each group of 4 values with one shuffle */
+template <uint32_t t_frame_size = 4096,
+    class t_model = ans_byte_model<t_frame_size> >
+struct ans_svbyte {
+public:
+    struct workspace {
+        std::vector<uint8_t> tmp_buf;
+        std::vector<uint8_t> ctrl_buf;
+        std::array<std::vector<uint8_t>, 4> data_buf;
+    };
+
+private:
+    t_model model_ctrl;
+    std::array<t_model, 4> model_data;
+    workspace ws;
+
+private:
+    static void encode(const t_model& m, uint8_t*& out8, uint8_t* buf,
+        size_t n, std::vector<uint8_t>& tmp_buf)
+    {
+        if (tmp_buf.size() < (n + 1) * 8) {
+            tmp_buf.resize((n + 1) * 8);
+        }
+        auto tmp_out_ptr = tmp_buf.data() + tmp_buf.size() - 1;
+        auto tmp_out_start = tmp_out_ptr;
+        tmp_out_ptr = m.template encode_block<1>(buf, n, tmp_out_ptr);
+        size_t enc_size = (tmp_out_start - tmp_out_ptr);
+        ans_vbyte_encode_u64(out8, enc_size);
+        memcpy(out8, tmp_out_ptr, enc_size);
+        out8 += enc_size;
+    }
+
+    static void decode(
+        const t_model& m, const uint8_t*& in8, uint8_t* buf, size_t n)
+    {
+        size_t enc_size = ans_vbyte_decode_u64(in8);
+        m.template decode_block<1>(in8, enc_size, buf, n);
+    }
+
+public:
+    bool required_increasing = false;
+    std::string name()
+    {
+        return "ans_svbyte_" + std::to_string(t_frame_size)
+            + t_model::name_suffix();
+    }
+    void init(const list_data& input, uint32_t* out, size_t& nvalue)
+    {
+        // (1) count control and position bytes on multiple threads
+        auto part_freqs = parallel_list_stats(input, ans_svbyte_freqs{},
+            [](ans_svbyte_freqs& f, const uint32_t* list, size_t n) {
+                ans_svbyte_freq_count(list, n, f);
+            });
+        ans_svbyte_freqs freqs{};
+        for (const auto& f : part_freqs) {
+            for (size_t s = 0; s < freqs.ctrl.size(); s++) {
+                freqs.ctrl[s] += f.ctrl[s];
+                for (size_t k = 0; k < 4; k++)
+                    freqs.data[k][s] += f.data[k][s];
+            }
+        }
+
+        // (2) init the models
+        model_ctrl = t_model(freqs.ctrl);
+        for (size_t k = 0; k < 4; k++)
+            model_data[k] = t_model(freqs.data[k]);
+
+        // (3) write out models
+        auto initout8 = reinterpret_cast<uint8_t*>(out);
+        auto out8 = initout8;
+        model_ctrl.write(out8);
+        for (size_t k = 0; k < 4; k++)
+            model_data[k].write(out8);
+
+        // (4) align to u32 boundary
+        size_t wb = out8 - initout8;
+        if (wb % sizeof(uint32_t) != 0) {
+            wb += sizeof(uint32_t) - (wb % (sizeof(uint32_t)));
+        }
+        nvalue = wb / sizeof(uint32_t);
+    }
+
+    const uint32_t* dec_init(const uint32_t* in)
+    {
+        auto initin8 = reinterpret_cast<const uint8_t*>(in);
+        auto in8 = initin8;
+        model_ctrl = t_model(in8);
+        for (size_t k = 0; k < 4; k++)
+            model_data[k] = t_model(in8);
+        size_t pbytes = in8 - initin8;
+        if (pbytes % sizeof(uint32_t) != 0) {
+            pbytes += sizeof(uint32_t) - (pbytes % (sizeof(uint32_t)));
+        }
+        return in + pbytes / sizeof(uint32_t);
+    }
+
+    void encodeArray(
+        const uint32_t* in, const size_t len, uint32_t* out, size_t& nvalue)
+    {
+        encodeArray(in, len, out, nvalue, ws);
+    }
+    void encodeArray(const uint32_t* in, const size_t len, uint32_t* out,
+        size_t& nvalue, workspace& w) const
+    {
+        // (1) split the list into control and position streams
+        size_t num_groups = (len + 3) / 4;
+        w.ctrl_buf.resize(num_groups);
+        for (size_t k = 0; k < 4; k++)
+            w.data_buf[k].resize(num_groups * 4);
+        std::array<size_t, 4> num_data{ { 0, 0, 0, 0 } };
+        for (size_t g = 0; g < num_groups; g++) {
+            uint32_t ctrl = 0;
+            for (size_t j = 0; j < 4; j++) {
+                uint32_t x = 4 * g + j < len ? in[4 * g + j] : 0;
+                uint32_t l = ans_svbyte_len(x);
+                ctrl |= (l - 1) << (2 * j);
+                for (size_t k = 0; k < l; k++)
+                    w.data_buf[k][num_data[k]++] = x >> (8 * k);
+            }
+            w.ctrl_buf[g] = ctrl;
+        }
+
+        // (2) write the sizes of the higher position streams
+        auto initout8 = reinterpret_cast<uint8_t*>(out);
+        auto out8 = initout8;
+        for (size_t k = 1; k < 4; k++)
+            ans_vbyte_encode_u64(out8, num_data[k]);
+
+        // (3) encode all non empty streams
+        if (num_groups != 0)
+            encode(model_ctrl, out8, w.ctrl_buf.data(), num_groups, w.tmp_buf);
+        for (size_t k = 0; k < 4; k++) {
+            if (num_data[k] != 0) {
+                encode(model_data[k], out8, w.data_buf[k].data(),
+                    num_data[k], w.tmp_buf);
+            }
+        }
+
+        // (4) align to u32 boundary
+        size_t wb = out8 - initout8;
+        if (wb % sizeof(uint32_t) != 0) {
+            wb += sizeof(uint32_t) - (wb % (sizeof(uint32_t)));
+        }
+        nvalue = wb / sizeof(uint32_t);
+    }
+    uint32_t* decodeArray(
+        const uint32_t* in, const size_t len, uint32_t* out, size_t list_len)
+    {
+        return decodeArray(in, len, out, list_len, ws);
+    }
+    /* writes up to 3 values past the end of the list */
+    uint32_t* decodeArray(const uint32_t* in, const size_t, uint32_t* out,
+        size_t list_len, workspace& w) const
+    {
+        auto in8 = reinterpret_cast<const uint8_t*>(in);
+
+        // (1) read the stream sizes
+        size_t num_groups = (list_len + 3) / 4;
+        std::array<size_t, 4> num_data{ { num_groups * 4, 0, 0, 0 } };
+        for (size_t k = 1; k < 4; k++)
+            num_data[k] = ans_vbyte_decode_u64(in8);
+
+        // (2) decode the streams. the position streams are padded so the
+        // reassembly can always load 4 bytes
+        if (w.ctrl_buf.size() < num_groups)
+            w.ctrl_buf.resize(num_groups);
+        if (num_groups != 0)
+            decode(model_ctrl, in8, w.ctrl_buf.data(), num_groups);
+        for (size_t k = 0; k < 4; k++) {
+            if (w.data_buf[k].size() < num_data[k] + 4)
+                w.data_buf[k].resize(num_data[k] + 4);
+            if (num_data[k] != 0)
+                decode(model_data[k], in8, w.data_buf[k].data(), num_data[k]);
+        }
+
+        // (3) reassemble each group with a single shuffle
+        const auto& table = ans_svbyte_group_table();
+        std::array<const uint8_t*, 4> pos;
+        for (size_t k = 0; k < 4; k++)
+            pos[k] = w.data_buf[k].data();
+        for (size_t g = 0; g < num_groups; g++) {
+            const auto& group = table[w.ctrl_buf[g]];
+            std::array<uint32_t, 4> bytes;
+            for (size_t k = 0; k < 4; k++) {
+                memcpy(&bytes[k], pos[k], sizeof(uint32_t));
+                pos[k] += group.counts[k];
+            }
+            __m128i v = _mm_loadu_si128((const __m128i*)bytes.data());
+            __m128i shuf = _mm_loadu_si128((const __m128i*)group.shuf.data());
+            _mm_storeu_si128(
+                (__m128i*)(out + 4 * g), _mm_shuffle_epi8(v, shuf));
+        }
+        return out + list_len;
+    }
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <algorithm>
+#include <cassert>
 #include <cstdint>
 #include <numeric>
 #include <vector>
@@ -65,6 +66,34 @@ uint64_t next_power_of_two(uint64_t x)
 
 bool is_power_of_two(uint64_t x) { return ((x != 0) && !(x & (x - 1))); }
 
+/* division-free x / f using a precomputed fixed-point reciprocal (Granlund
+   and Montgomery, "Division by invariant integers using multiplication").
+   exact for x < 2^(16 + ceil(log2(f))) which covers every state the
+   encoders see after renormalizing with OUTPUT_BASE = 256 (x < 2^16 * f).
+   other ranges can be requested with x_bits: exact for x < 2^x_bits */
+struct ans_reciprocal {
+    typedef unsigned int uint128_t __attribute__((mode(TI)));
+    uint64_t rcp = 0;
+    uint8_t shift = 0;
+
+    static uint8_t ceil_log2(uint64_t f)
+    {
+        return (f == 1) ? 0 : bits::hi(f - 1) + 1;
+    }
+
+    ans_reciprocal() = default;
+    ans_reciprocal(uint64_t f)
+        : ans_reciprocal(f, 16 + ceil_log2(f))
+    {
+    }
+    ans_reciprocal(uint64_t f, uint8_t x_bits)
+    {
+        shift = x_bits + ceil_log2(f);
+        rcp = ((uint128_t(1) << shift) + f - 1) / f;
+    }
+    uint64_t div(uint64_t x) const { return (uint128_t(x) * rcp) >> shift; }
+};
+
 template <class t_itr>
 void print_array(
     t_itr itr, size_t n, const char* name, std::string format = "%u")
@@ -162,7 +191,7 @@ std::vector<uint64_t> normalize_freqs_power_of_two_alistair(
     std::vector<uint64_t> nfreqs(freqs.begin(), freqs.end());
     uint32_t n = 0;
     uint64_t initial_sum = 0;
-    for (size_t i = 1; i < freqs.size(); i++) {
+    for (size_t i = 0; i < freqs.size(); i++) {
         if (freqs[i] != 0) {
             n = i + 1;
             initial_sum += freqs[i];
@@ -172,7 +201,7 @@ std::vector<uint64_t> normalize_freqs_power_of_two_alistair(
        last bucket, assume it is the smallest n(s) area, scale
        the rest by the same amount */
     double C = double(target_power) / double(initial_sum);
-    for (size_t i = 1; i < n; i++) {
+    for (size_t i = 0; i < n; i++) {
         nfreqs[i] = 0.95 * nfreqs[i] * C;
         if (freqs[i] != 0 && nfreqs[i] < 1) {
             nfreqs[i] = 1;
@@ -184,6 +213,16 @@ std::vector<uint64_t> normalize_freqs_power_of_two_alistair(
     for (size_t m = 0; m < n; m++) {
         M += nfreqs[m];
     }
+    /* many rare symbols rounded up to 1 can push the sum over the target.
+       take the overshoot from the largest buckets. this ends as long as
+       there are no more symbols than the target */
+    assert(n <= target_power);
+    while (M > target_power) {
+        auto largest = std::max_element(nfreqs.begin(), nfreqs.begin() + n);
+        uint64_t take = std::min(M - target_power, *largest / 2);
+        *largest -= take;
+        M -= take;
+    }
     /* fourth phase, round up to a power of two and then redistribute */
     uint64_t excess = target_power - M;
     /* flow that excess count backwards to the beginning of
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <array>
+
+#include "ans-byte.hpp"
+#include "ans-constants.hpp"
+#include "ans-util.hpp"
+#include "ans-vbyte-single.hpp"
+#include "util.hpp"
+
+namespace constants {
+const uint32_t VBYTE_CONTEXTS = 4;
+}
+
+/* context of the next value given the vbyte length of the current one.
+   lengths of 4 and more share a context. the first value of a list is
+   coded in the context of a single byte value */
+inline const std::array<uint8_t, 11>& ans_vbyte_ctx_table()
+{
+    static const std::array<uint8_t, 11> ctx{ { 0, 0, 1, 2, 3, 3, 3, 3, 3,
+        3, 3 } };
+    return ctx;
+}
+
+/* order-1 context modelled ans_vbyte_single. the bytes of each value are
+   coded with one of constants::VBYTE_CONTEXTS byte models, picked by the
+   vbyte length of the previous value in the list. all models share one
+   rANS state; this works as every model is normalized to the same frame
+   size and so has the same normalization interval. needs a model with a
+   per symbol encode and decode (ans_byte_model) */
+template <uint32_t t_frame_size = 4096,
+    class t_model = ans_byte_model<t_frame_size> >
+struct ans_vbyte_ctx {
+public:
+    struct workspace {
+        std::vector<uint8_t> tmp_buf;
+        std::vector<uint8_t> vbyte_buf;
+        std::vector<uint8_t> ctx_buf;
+    };
+
+private:
+    std::array<t_model, constants::VBYTE_CONTEXTS> models;
+    workspace ws;
+
+public:
+    bool required_increasing = false;
+    std::string name()
+    {
+        return "ans_vbyte_ctx_" + std::to_string(t_frame_size)
+            + t_model::name_suffix();
+    }
+    void init(const list_data& input, uint32_t* out, size_t& nvalue)
+    {
+        // (1) count vbyte bytes per context on multiple threads and merge
+        using ctx_freqs = std::array<freq_table, constants::VBYTE_CONTEXTS>;
+        auto part_freqs = parallel_list_stats(input, ctx_freqs{},
+            [](ctx_freqs& f, const uint32_t* list, size_t n) {
+                const auto& ctx_of_len = ans_vbyte_ctx_table();
+                size_t ctx = 0;
+                for (size_t j = 0; j < n; j++) {
+                    ans_vbyte_freq_count(list[j], f[ctx]);
+                    ctx = ctx_of_len[ans_vbyte_size(list[j])];
+                }
+            });
+        ctx_freqs freqs{};
+        for (const auto& f : part_freqs) {
+            for (size_t c = 0; c < constants::VBYTE_CONTEXTS; c++) {
+                for (size_t s = 0; s < freqs[c].size(); s++)
+                    freqs[c][s] += f[c][s];
+            }
+        }
+
+        // (2) init the models
+        for (size_t c = 0; c < constants::VBYTE_CONTEXTS; c++)
+            models[c] = t_model(freqs[c]);
+
+        // (3) write out models
+        auto initout8 = reinterpret_cast<uint8_t*>(out);
+        auto out8 = initout8;
+        for (size_t c = 0; c < constants::VBYTE_CONTEXTS; c++)
+            models[c].write(out8);
+
+        // (4) align to u32 boundary
+        size_t wb = out8 - initout8;
+        if (wb % sizeof(uint32_t) != 0) {
+            wb += sizeof(uint32_t) - (wb % (sizeof(uint32_t)));
+        }
+        nvalue = wb / sizeof(uint32_t);
+    }
+
+    const uint32_t* dec_init(const uint32_t* in)
+    {
+        auto initin8 = reinterpret_cast<const uint8_t*>(in);
+        auto in8 = initin8;
+        for (size_t c = 0; c < constants::VBYTE_CONTEXTS; c++)
+            models[c] = t_model(in8);
+        size_t pbytes = in8 - initin8;
+        if (pbytes % sizeof(uint32_t) != 0) {
+            pbytes += sizeof(uint32_t) - (pbytes % (sizeof(uint32_t)));
+        }
+        return in + pbytes / sizeof(uint32_t);
+    }
+
+    void encodeArray(
+        const uint32_t* in, const size_t len, uint32_t* out, size_t& nvalue)
+    {
+        encodeArray(in, len, out, nvalue, ws);
+    }
+    void encodeArray(const uint32_t* in, const size_t len, uint32_t* out,
+        size_t& nvalue, workspace& w) const
+    {
+        // (1) vbyte encode list and note the context of each byte
+        if (w.vbyte_buf.size() < len * 8) {
+            w.vbyte_buf.resize(len * 8);
+            w.ctx_buf.resize(len * 8);
+        }
+        const auto& ctx_of_len = ans_vbyte_ctx_table();
+        auto vb_ptr = w.vbyte_buf.data();
+        size_t ctx = 0;
+        for (size_t j = 0; j < len; j++) {
+            auto vb_start = vb_ptr;
+            ans_vbyte_encode_u64(vb_ptr, in[j]);
+            size_t vb_len = vb_ptr - vb_start;
+            memset(w.ctx_buf.data() + (vb_start - w.vbyte_buf.data()), ctx,
+                vb_len);
+            ctx = ctx_of_len[vb_len];
+        }
+        size_t num_vb = vb_ptr - w.vbyte_buf.data();
+
+        // (2) encode the bytes in reverse order into the tmp buf
+        if (w.tmp_buf.size() < (num_vb + 1) * 8) {
+            w.tmp_buf.resize((num_vb + 1) * 8);
+        }
+        auto tmp_out_ptr = w.tmp_buf.data() + w.tmp_buf.size() - 1;
+        auto tmp_out_start = tmp_out_ptr;
+        uint32_t state = constants::ANS_START_STATE;
+        for (size_t i = num_vb; i != 0; i--) {
+            state = models[w.ctx_buf[i - 1]].encode(
+                state, w.vbyte_buf[i - 1], tmp_out_ptr);
+        }
+        models[0].flush(state, tmp_out_ptr);
+        size_t enc_size = tmp_out_start - tmp_out_ptr;
+
+        // (3) write the output
+        auto initout8 = reinterpret_cast<uint8_t*>(out);
+        auto out8 = initout8;
+        ans_vbyte_encode_u64(out8, enc_size);
+        memcpy(out8, tmp_out_ptr, enc_size);
+        out8 += enc_size;
+
+        // (4) align to u32 boundary
+        size_t wb = out8 - initout8;
+        if (wb % sizeof(uint32_t) != 0) {
+            wb += sizeof(uint32_t) - (wb % (sizeof(uint32_t)));
+        }
+        nvalue = wb / sizeof(uint32_t);
+    }
+    uint32_t* decodeArray(
+        const uint32_t* in, const size_t len, uint32_t* out, size_t list_len)
+    {
+        return decodeArray(in, len, out, list_len, ws);
+    }
+    uint32_t* decodeArray(const uint32_t* in, const size_t, uint32_t* out,
+        size_t list_len, workspace&) const
+    {
+        auto in8 = reinterpret_cast<const uint8_t*>(in);
+
+        // (1) read the parameters
+        size_t enc_size = ans_vbyte_decode_u64(in8);
+        uint32_t state = models[0].init_decoder(in8, enc_size);
+
+        // (2) decode value by value, switching models on the length of
+        // the previous value
+        const auto& ctx_of_len = ans_vbyte_ctx_table();
+        const t_model* m = &models[0];
+        for (size_t i = 0; i < list_len; i++) {
+            uint8_t b = m->decode(state, in8, enc_size);
+            uint32_t num = b & 127;
+            uint32_t vb_len = 1;
+            while (b > 127) {
+                b = m->decode(state, in8, enc_size);
+                num += uint32_t(b & 127) << (7 * vb_len);
+                vb_len++;
+            }
+            *out++ = num;
+            m = &models[ctx_of_len[vb_len]];
+        }
+        return out;
+    }
+};
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+
+#include "ans-byte.hpp"
+#include "ans-constants.hpp"
+#include "ans-util.hpp"
+#include "ans-vbyte-single.hpp"
+#include "util.hpp"
+
+/* ans_vbyte_single with t_num_models byte models instead of one. init
+   clusters the lists: they start out in length classes holding about the
+   same number of postings each, then each round builds one model per
+   cluster and moves every list to the model that codes it in the fewest
+   bits. encodeArray picks the cheapest model per list and stores its id in
+   front of the list. every model gets all symbols of the collection so
+   any list can be coded with any of them */
+template <uint32_t t_frame_size = 4096, uint32_t t_num_models = 4,
+    class t_model = ans_byte_model<t_frame_size> >
+struct ans_vbyte_multi {
+    static_assert(t_num_models >= 1 && t_num_models < 128,
+        "the model id is stored in a single byte");
+
+public:
+    struct workspace {
+        std::vector<uint8_t> tmp_buf;
+        std::vector<uint8_t> vbyte_buf;
+    };
+
+private:
+    static const uint32_t train_rounds = 3;
+    using model_freqs = std::array<freq_table, t_num_models>;
+    using model_costs = std::array<std::array<float, constants::MAX_SIGMA>,
+        t_num_models>;
+
+    std::array<t_model, t_num_models> models;
+    /* bits each model spends on each symbol */
+    model_costs costs;
+    workspace ws;
+
+private:
+    static void encode(const t_model& m, uint8_t*& out8, uint8_t* buf,
+        size_t n, std::vector<uint8_t>& tmp_buf)
+    {
+        if (tmp_buf.size() < (n + 1) * 8) {
+            tmp_buf.resize((n + 1) * 8);
+        }
+        auto tmp_out_ptr = tmp_buf.data() + tmp_buf.size() - 1;
+        auto tmp_out_start = tmp_out_ptr;
+        tmp_out_ptr = m.template encode_block<1>(buf, n, tmp_out_ptr);
+        size_t enc_size = (tmp_out_start - tmp_out_ptr);
+        ans_vbyte_encode_u64(out8, enc_size);
+        memcpy(out8, tmp_out_ptr, enc_size);
+        out8 += enc_size;
+    }
+
+    static void decode(
+        const t_model& m, const uint8_t*& in8, uint8_t* buf, size_t n)
+    {
+        size_t enc_size = ans_vbyte_decode_u64(in8);
+        m.template decode_block<1>(in8, enc_size, buf, n);
+    }
+
+    /* build the models from the cluster counts. symbols seen anywhere in
+       the collection get a count of at least one in every model */
+    void build_models(model_freqs& freqs)
+    {
+        freq_table seen{ 0 };
+        for (const auto& f : freqs) {
+            for (size_t s = 0; s < f.size(); s++)
+                seen[s] += f[s];
+        }
+        for (size_t k = 0; k < t_num_models; k++) {
+            for (size_t s = 0; s < seen.size(); s++) {
+                if (seen[s] != 0 && freqs[k][s] == 0)
+                    freqs[k][s] = 1;
+            }
+            models[k] = t_model(freqs[k]);
+        }
+        for (size_t k = 0; k < t_num_models; k++) {
+            const auto& nf = models[k].normalized_freqs;
+            for (size_t s = 0; s < constants::MAX_SIGMA; s++) {
+                if (s < nf.size() && nf[s] != 0) {
+                    costs[k][s] = std::log2(double(t_frame_size) / nf[s]);
+                } else {
+                    costs[k][s] = std::numeric_limits<float>::infinity();
+                }
+            }
+        }
+    }
+
+    /* id of the model coding the n vbyte bytes in buf in the fewest bits */
+    size_t cheapest_model(const uint8_t* buf, size_t n) const
+    {
+        std::array<float, t_num_models> bits;
+        bits.fill(0);
+        for (size_t i = 0; i < n; i++) {
+            for (size_t k = 0; k < t_num_models; k++)
+                bits[k] += costs[k][buf[i]];
+        }
+        return std::min_element(bits.begin(), bits.end()) - bits.begin();
+    }
+
+public:
+    bool required_increasing = false;
+    std::string name()
+    {
+        return "ans_vbyte_multi_" + std::to_string(t_frame_size) + "_K"
+            + std::to_string(t_num_models) + t_model::name_suffix();
+    }
+    void init(const list_data& input, uint32_t* out, size_t& nvalue)
+    {
+        // (1) length classes with about the same number of postings
+        std::vector<uint32_t> sizes(input.list_sizes.begin(),
+            input.list_sizes.begin() + input.num_lists);
+        std::sort(sizes.begin(), sizes.end());
+        std::vector<uint32_t> class_bounds;
+        uint64_t postings = 0;
+        for (auto n : sizes) {
+            postings += n;
+            if (class_bounds.size() + 1 < t_num_models
+                && postings * t_num_models
+                    >= (class_bounds.size() + 1) * input.num_postings) {
+                class_bounds.push_back(n);
+            }
+        }
+
+        // (2) count the vbyte bytes of each list into its cluster. in the
+        // first round a list goes to its length class, afterwards to the
+        // model of the previous round coding it in the fewest bits. each
+        // thread reuses one vbyte buffer for all its lists
+        struct multi_stats {
+            model_freqs freqs;
+            std::vector<uint8_t> vbyte_buf;
+        };
+        model_freqs freqs;
+        for (uint32_t round = 0; round <= train_rounds; round++) {
+            auto part_stats = parallel_list_stats(input, multi_stats{},
+                [&](multi_stats& st, const uint32_t* list, size_t n) {
+                    if (st.vbyte_buf.size() < n * 5) {
+                        st.vbyte_buf.resize(n * 5);
+                    }
+                    auto vb_ptr = st.vbyte_buf.data();
+                    for (size_t j = 0; j < n; j++)
+                        ans_vbyte_encode_u64(vb_ptr, list[j]);
+                    size_t num_vb = vb_ptr - st.vbyte_buf.data();
+                    size_t k = std::lower_bound(class_bounds.begin(),
+                                   class_bounds.end(), n)
+                        - class_bounds.begin();
+                    if (round != 0)
+                        k = cheapest_model(st.vbyte_buf.data(), num_vb);
+                    for (size_t i = 0; i < num_vb; i++)
+                        st.freqs[k][st.vbyte_buf[i]]++;
+                });
+            freqs = model_freqs{};
+            for (const auto& st : part_stats) {
+                for (size_t k = 0; k < t_num_models; k++) {
+                    for (size_t s = 0; s < st.freqs[k].size(); s++)
+                        freqs[k][s] += st.freqs[k][s];
+                }
+            }
+            build_models(freqs);
+        }
+
+        // (3) write out models
+        auto initout8 = reinterpret_cast<uint8_t*>(out);
+        auto out8 = initout8;
+        for (size_t k = 0; k < t_num_models; k++)
+            models[k].write(out8);
+
+        // (4) align to u32 boundary
+        size_t wb = out8 - initout8;
+        if (wb % sizeof(uint32_t) != 0) {
+            wb += sizeof(uint32_t) - (wb % (sizeof(uint32_t)));
+        }
+        nvalue = wb / sizeof(uint32_t);
+    }
+
+    const uint32_t* dec_init(const uint32_t* in)
+    {
+        auto initin8 = reinterpret_cast<const uint8_t*>(in);
+        auto in8 = initin8;
+        for (size_t k = 0; k < t_num_models; k++)
+            models[k] = t_model(in8);
+        size_t pbytes = in8 - initin8;
+        if (pbytes % sizeof(uint32_t) != 0) {
+            pbytes += sizeof(uint32_t) - (pbytes % (sizeof(uint32_t)));
+        }
+        return in + pbytes / sizeof(uint32_t);
+    }
+
+    void encodeArray(
+        const uint32_t* in, const size_t len, uint32_t* out, size_t& nvalue)
+    {
+        encodeArray(in, len, out, nvalue, ws);
+    }
+    void encodeArray(const uint32_t* in, const size_t len, uint32_t* out,
+        size_t& nvalue, workspace& w) const
+    {
+        // (1) vbyte encode list
+        if (w.vbyte_buf.size() < len * 8) {
+            w.vbyte_buf.resize(len * 8);
+        }
+        auto vb_ptr = w.vbyte_buf.data();
+        for (size_t j = 0; j < len; j++) {
+            ans_vbyte_encode_u64(vb_ptr, in[j]);
+        }
+        size_t num_vb = (vb_ptr - w.vbyte_buf.data());
+
+        // (2) write the model id and the number of continuation bytes
+        size_t k = cheapest_model(w.vbyte_buf.data(), num_vb);
+        auto initout8 = reinterpret_cast<uint8_t*>(out);
+        auto out8 = initout8;
+        *out8++ = k;
+        ans_vbyte_encode_u64(out8, num_vb - len);
+
+        // (3) encode the bytes with the chosen model
+        encode(models[k], out8, w.vbyte_buf.data(), num_vb, w.tmp_buf);
+
+        // (4) align to u32 boundary
+        size_t wb = out8 - initout8;
+        if (wb % sizeof(uint32_t) != 0) {
+            wb += sizeof(uint32_t) - (wb % (sizeof(uint32_t)));
+        }
+        nvalue = wb / sizeof(uint32_t);
+    }
+    uint32_t* decodeArray(
+        const uint32_t* in, const size_t len, uint32_t* out, size_t list_len)
+    {
+        return decodeArray(in, len, out, list_len, ws);
+    }
+    uint32_t* decodeArray(const uint32_t* in, const size_t, uint32_t* out,
+        size_t list_len, workspace& w) const
+    {
+        auto in8 = reinterpret_cast<const uint8_t*>(in);
+
+        // (1) read the parameters
+        size_t k = *in8++;
+        size_t num_vb = list_len + ans_vbyte_decode_u64(in8);
+        auto& buf = w.vbyte_buf;
+        if (buf.size() < num_vb) {
+            buf.resize(num_vb);
+        }
+
+        // (2) decode the bytes with the model of the list
+        decode(models[k], in8, buf.data(), num_vb);
+
+        // (3) and turn them back into values
+        const uint8_t* vb_ptr = buf.data();
+        for (size_t i = 0; i < list_len; i++) {
+            *out++ = ans_vbyte_decode_u64(vb_ptr);
+        }
+        return out;
+    }
+};
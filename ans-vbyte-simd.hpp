@@ -0,0 +1,410 @@
+#pragma once
+
+#include <array>
+#include <immintrin.h>
+#include <memory>
+
+#include "ans-byte.hpp"
+#include "ans-constants.hpp"
+#include "ans-util.hpp"
+#include "ans-vbyte-single.hpp"
+#include "util.hpp"
+
+namespace constants {
+const uint32_t SIMD_LANES = 16;
+const uint32_t SIMD_LOWER_BOUND = 1 << 16;
+const uint8_t SIMD_WORD_LOG2 = 16;
+}
+
+/* lane-interleaved rANS with 32 bit states and 16 bit renormalization.
+   symbol i is coded by lane i % SIMD_LANES. after each group of lanes
+   the decoder refills every lane whose state dropped below the lower bound,
+   reading one 16 bit word per lane in lane order. this makes a group
+   decodable with one gather, one multiply and one expand/permute. */
+
+/* the kernels gather dec_table_entry_u32 entries as raw 32 bit words */
+inline void ans_simd_decode_lane(const dec_table_entry_u32* table,
+    uint8_t log2_M, uint32_t mask_M, uint32_t& x, const uint8_t*& in8,
+    uint8_t* out)
+{
+    const auto e = table[x & mask_M];
+    *out = e.get_sym();
+    x = e.get_freq() * (x >> log2_M) + e.get_offset();
+    if (x < constants::SIMD_LOWER_BOUND) {
+        uint16_t w;
+        memcpy(&w, in8, sizeof(uint16_t));
+        in8 += sizeof(uint16_t);
+        x = (x << constants::SIMD_WORD_LOG2) | w;
+    }
+}
+
+/* for each 8 bit renorm mask, the source word of each lane */
+inline const std::array<std::array<uint32_t, 8>, 256>& ans_simd_perm_table()
+{
+    static const std::array<std::array<uint32_t, 8>, 256> perm = [] {
+        std::array<std::array<uint32_t, 8>, 256> p;
+        for (uint32_t m = 0; m < 256; m++) {
+            uint32_t next = 0;
+            for (uint32_t j = 0; j < 8; j++) {
+                p[m][j] = (m & (1 << j)) ? next++ : 0;
+            }
+        }
+        return p;
+    }();
+    return perm;
+}
+
+__attribute__((target("avx2"))) inline __m256i ans_simd_step_avx2(
+    const uint32_t* table, __m128i log2_M, __m256i mask_M, __m256i x,
+    const uint8_t*& in8, uint8_t* out)
+{
+    const auto& perm = ans_simd_perm_table();
+    const __m256i lo12 = _mm256_set1_epi32(0xFFF);
+    const __m256i bias = _mm256_set1_epi32(0x80000000);
+    const __m256i lower
+        = _mm256_set1_epi32(constants::SIMD_LOWER_BOUND ^ 0x80000000);
+    const __m256i sym_shuf = _mm256_setr_epi8(3, 7, 11, 15, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, 3, 7, 11, 15, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1);
+    const __m256i sym_perm = _mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1);
+
+    // (1) lookup and state transform
+    __m256i slot = _mm256_and_si256(x, mask_M);
+    __m256i e = _mm256_i32gather_epi32(
+        reinterpret_cast<const int*>(table), slot, 4);
+    __m256i f
+        = _mm256_add_epi32(_mm256_and_si256(e, lo12), _mm256_set1_epi32(1));
+    __m256i off = _mm256_and_si256(_mm256_srli_epi32(e, 12), lo12);
+    x = _mm256_add_epi32(
+        _mm256_mullo_epi32(f, _mm256_srl_epi32(x, log2_M)), off);
+
+    // (2) output symbols
+    __m256i syms = _mm256_permutevar8x32_epi32(
+        _mm256_shuffle_epi8(e, sym_shuf), sym_perm);
+    _mm_storel_epi64(
+        reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(syms));
+
+    // (3) renormalize the lanes that dropped below the lower bound
+    __m256i need = _mm256_cmpgt_epi32(lower, _mm256_xor_si256(x, bias));
+    uint32_t m = _mm256_movemask_ps(_mm256_castsi256_ps(need));
+    __m256i words = _mm256_cvtepu16_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in8)));
+    __m256i p = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(perm[m].data()));
+    __m256i w = _mm256_permutevar8x32_epi32(words, p);
+    __m256i xs = _mm256_or_si256(
+        _mm256_slli_epi32(x, constants::SIMD_WORD_LOG2), w);
+    in8 += sizeof(uint16_t) * __builtin_popcount(m);
+    return _mm256_blendv_epi8(x, xs, need);
+}
+
+__attribute__((target("avx2"))) inline size_t ans_simd_decode_avx2(
+    const uint32_t* table, uint8_t log2_M, uint32_t* states,
+    const uint8_t*& in8, const uint8_t* in_end, uint8_t* out, size_t n)
+{
+    const __m128i shift = _mm_cvtsi32_si128(log2_M);
+    const __m256i mask_M = _mm256_set1_epi32((1U << log2_M) - 1);
+    __m256i x0 = _mm256_loadu_si256(reinterpret_cast<__m256i*>(states));
+    __m256i x1 = _mm256_loadu_si256(reinterpret_cast<__m256i*>(states + 8));
+    size_t i = 0;
+    // each half loads 16 bytes of renorm words
+    for (; i < n && (in_end - in8) >= 32; i += constants::SIMD_LANES) {
+        x0 = ans_simd_step_avx2(table, shift, mask_M, x0, in8, out + i);
+        x1 = ans_simd_step_avx2(table, shift, mask_M, x1, in8, out + i + 8);
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(states), x0);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(states + 8), x1);
+    return i;
+}
+
+// gcc flags the _mm512_undefined_* passthrough operands of the intrinsics
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f"))) inline size_t ans_simd_decode_avx512(
+    const uint32_t* table, uint8_t log2_M, uint32_t* states,
+    const uint8_t*& in8, const uint8_t* in_end, uint8_t* out, size_t n)
+{
+    const __m128i shift = _mm_cvtsi32_si128(log2_M);
+    const __m512i mask_M = _mm512_set1_epi32((1U << log2_M) - 1);
+    const __m512i lo12 = _mm512_set1_epi32(0xFFF);
+    const __m512i one = _mm512_set1_epi32(1);
+    const __m512i lower = _mm512_set1_epi32(constants::SIMD_LOWER_BOUND);
+    __m512i x = _mm512_loadu_si512(states);
+    size_t i = 0;
+    for (; i < n && (in_end - in8) >= 32; i += constants::SIMD_LANES) {
+        // (1) lookup and state transform
+        __m512i slot = _mm512_and_si512(x, mask_M);
+        __m512i e = _mm512_i32gather_epi32(slot, table, 4);
+        __m512i f = _mm512_add_epi32(_mm512_and_si512(e, lo12), one);
+        __m512i off = _mm512_and_si512(_mm512_srli_epi32(e, 12), lo12);
+        x = _mm512_add_epi32(
+            _mm512_mullo_epi32(f, _mm512_srl_epi32(x, shift)), off);
+
+        // (2) output symbols
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+            _mm512_cvtepi32_epi8(_mm512_srli_epi32(e, 24)));
+
+        // (3) renormalize the lanes that dropped below the lower bound
+        __mmask16 k = _mm512_cmplt_epu32_mask(x, lower);
+        __m512i words = _mm512_cvtepu16_epi32(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in8)));
+        __m512i w = _mm512_maskz_expand_epi32(k, words);
+        x = _mm512_mask_or_epi32(
+            x, k, _mm512_slli_epi32(x, constants::SIMD_WORD_LOG2), w);
+        in8 += sizeof(uint16_t) * __builtin_popcount(k);
+    }
+    _mm512_storeu_si512(states, x);
+    return i;
+}
+#pragma GCC diagnostic pop
+
+enum class ans_simd_kernel { scalar, avx2, avx512 };
+
+inline ans_simd_kernel ans_simd_detect_kernel()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return ans_simd_kernel::avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return ans_simd_kernel::avx2;
+    return ans_simd_kernel::scalar;
+}
+
+inline std::string ans_simd_kernel_name(ans_simd_kernel k)
+{
+    switch (k) {
+    case ans_simd_kernel::avx512:
+        return "avx512";
+    case ans_simd_kernel::avx2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+template <uint32_t t_frame_size = 4096> struct ans_vbyte_simd {
+public:
+    /* the vbyte bytes of the list and the reversed rANS output */
+    struct workspace {
+        std::vector<uint8_t> tmp_buf;
+        std::vector<uint8_t> vbyte_buf;
+    };
+
+private:
+    using model_type = ans_byte_model<t_frame_size, dec_table_entry_u32>;
+    model_type model;
+    /* reciprocals of the frequencies valid for any 32 bit state */
+    std::vector<ans_reciprocal> rcp_freqs;
+    ans_simd_kernel kernel = ans_simd_detect_kernel();
+    workspace ws;
+
+private:
+    uint32_t encode_sym(uint32_t x, uint8_t sym, uint8_t*& out8) const
+    {
+        uint32_t f = model.normalized_freqs[sym];
+        uint32_t b = model.base[sym];
+        // (1) renormalize by at most one 16 bit word
+        uint64_t x_max = uint64_t((constants::SIMD_LOWER_BOUND >> model.log2_M)
+                             << constants::SIMD_WORD_LOG2)
+            * f;
+        if (x >= x_max) {
+            uint16_t w = x & 0xFFFF;
+            out8 -= sizeof(uint16_t);
+            memcpy(out8, &w, sizeof(uint16_t));
+            x >>= constants::SIMD_WORD_LOG2;
+        }
+        // (2) transform state. q = x / f without a division
+        uint32_t q = rcp_freqs[sym].div(x);
+        return (q << model.log2_M) + (x - q * f) + b;
+    }
+
+    void encode(uint8_t*& out8, const uint8_t* buf, size_t n,
+        std::vector<uint8_t>& tmp_buf) const
+    {
+        size_t max_bytes = n * 2 + constants::SIMD_LANES * sizeof(uint32_t);
+        if (tmp_buf.size() < max_bytes) {
+            tmp_buf.resize(max_bytes);
+        }
+        std::array<uint32_t, constants::SIMD_LANES> states;
+        states.fill(constants::SIMD_LOWER_BOUND);
+        auto tmp_out_start = tmp_buf.data() + tmp_buf.size();
+        auto tmp_out_ptr = tmp_out_start;
+        // we encode the input in reverse order
+        for (size_t i = n; i != 0; i--) {
+            auto& x = states[(i - 1) % constants::SIMD_LANES];
+            x = encode_sym(x, buf[i - 1], tmp_out_ptr);
+        }
+        // flush in reverse so the decoder reads lane 0 first
+        for (size_t k = constants::SIMD_LANES; k != 0; k--) {
+            tmp_out_ptr -= sizeof(uint32_t);
+            memcpy(tmp_out_ptr, &states[k - 1], sizeof(uint32_t));
+        }
+        size_t enc_size = (tmp_out_start - tmp_out_ptr);
+
+        // write the output
+        ans_vbyte_encode_u64(out8, enc_size);
+        memcpy(out8, tmp_out_ptr, enc_size);
+        out8 += enc_size;
+    }
+
+    void decode(const uint8_t*& in8, uint8_t* buf, size_t n) const
+    {
+        size_t enc_size = ans_vbyte_decode_u64(in8);
+        const uint8_t* in_end = in8 + enc_size;
+        std::array<uint32_t, constants::SIMD_LANES> states;
+        memcpy(states.data(), in8, sizeof(states));
+        in8 += sizeof(states);
+
+        // (1) decode full groups with the widest kernel available
+        size_t n_full = n - (n % constants::SIMD_LANES);
+        size_t i = 0;
+        const auto table = model.dec_table.data();
+        const auto table_u32 = reinterpret_cast<const uint32_t*>(table);
+        if (kernel == ans_simd_kernel::avx512) {
+            i = ans_simd_decode_avx512(table_u32, model.log2_M, states.data(),
+                in8, in_end, buf, n_full);
+        } else if (kernel == ans_simd_kernel::avx2) {
+            i = ans_simd_decode_avx2(table_u32, model.log2_M, states.data(),
+                in8, in_end, buf, n_full);
+        }
+
+        // (2) the scalar decoder handles the end of the stream
+        for (; i < n; i++) {
+            ans_simd_decode_lane(table, model.log2_M, model.mask_M,
+                states[i % constants::SIMD_LANES], in8, buf + i);
+        }
+    }
+
+public:
+    ans_vbyte_simd() = default;
+    /* decode with kernel k instead of the widest one the cpu supports. k
+       has to be supported by the cpu */
+    explicit ans_vbyte_simd(ans_simd_kernel k)
+        : kernel(k)
+    {
+    }
+
+    bool required_increasing = false;
+    std::string name()
+    {
+        return "ans_vbyte_simd_" + std::to_string(t_frame_size);
+    }
+    void init(const list_data& input, uint32_t* out, size_t& nvalue)
+    {
+        // (1) count vbyte info on multiple threads and merge
+        auto part_freqs = parallel_list_stats(input, freq_table{ 0 },
+            [](freq_table& f, const uint32_t* list, size_t n) {
+                for (size_t j = 0; j < n; j++) {
+                    ans_vbyte_freq_count(list[j], f);
+                }
+            });
+        freq_table freqs{ 0 };
+        for (const auto& f : part_freqs) {
+            for (size_t s = 0; s < freqs.size(); s++)
+                freqs[s] += f[s];
+        }
+
+        // (2) init model and move
+        model = std::move(model_type(freqs));
+
+        // (2a) the encoder states span 32 bits, more than the reciprocals
+        // of the model cover
+        rcp_freqs.resize(model.normalized_freqs.size());
+        for (size_t s = 0; s < rcp_freqs.size(); s++) {
+            if (model.normalized_freqs[s] != 0)
+                rcp_freqs[s] = ans_reciprocal(model.normalized_freqs[s], 32);
+        }
+
+        // (3) write out models
+        auto initout8 = reinterpret_cast<uint8_t*>(out);
+        auto out8 = initout8;
+        model.write(out8);
+
+        // (4) align to u32 boundary
+        size_t wb = out8 - initout8;
+        if (wb % sizeof(uint32_t) != 0) {
+            wb += sizeof(uint32_t) - (wb % (sizeof(uint32_t)));
+        }
+        nvalue = wb / sizeof(uint32_t);
+    };
+
+    const uint32_t* dec_init(const uint32_t* in)
+    {
+        auto initin8 = reinterpret_cast<const uint8_t*>(in);
+        auto in8 = initin8;
+        model = model_type(in8);
+        size_t pbytes = in8 - initin8;
+        if (pbytes % sizeof(uint32_t) != 0) {
+            pbytes += sizeof(uint32_t) - (pbytes % (sizeof(uint32_t)));
+        }
+        size_t u32s = pbytes / sizeof(uint32_t);
+        return in + u32s;
+    }
+
+    void encodeArray(
+        const uint32_t* in, const size_t len, uint32_t* out, size_t& nvalue)
+    {
+        encodeArray(in, len, out, nvalue, ws);
+    }
+    void encodeArray(const uint32_t* in, const size_t len, uint32_t* out,
+        size_t& nvalue, workspace& w) const
+    {
+        // (1) vbyte encode list
+        auto& tmp_vbyte_buf = w.vbyte_buf;
+        if (tmp_vbyte_buf.size() < len * 8) {
+            tmp_vbyte_buf.resize(len * 8);
+        }
+
+        auto vb_ptr = tmp_vbyte_buf.data();
+        for (size_t j = 0; j < len; j++) {
+            uint32_t num = in[j];
+            ans_vbyte_encode_u64(vb_ptr, num);
+        }
+        auto initout8 = reinterpret_cast<uint8_t*>(out);
+        auto out8 = initout8;
+        size_t num_vb = (vb_ptr - tmp_vbyte_buf.data());
+
+        // (2) write num vbytes we will encode
+        ans_vbyte_encode_u64(out8, num_vb - len);
+
+        // (3) encode the vbytes
+        encode(out8, tmp_vbyte_buf.data(), num_vb, w.tmp_buf);
+
+        // (4) align to u32 boundary
+        size_t wb = out8 - initout8;
+        if (wb % sizeof(uint32_t) != 0) {
+            wb += sizeof(uint32_t) - (wb % (sizeof(uint32_t)));
+        }
+        nvalue = wb / sizeof(uint32_t);
+    }
+    uint32_t* decodeArray(
+        const uint32_t* in, const size_t len, uint32_t* out, size_t list_len)
+    {
+        return decodeArray(in, len, out, list_len, ws);
+    }
+    uint32_t* decodeArray(const uint32_t* in, const size_t, uint32_t* out,
+        size_t list_len, workspace& w) const
+    {
+        auto initin8 = reinterpret_cast<const uint8_t*>(in);
+        auto in8 = initin8;
+
+        auto& buf = w.vbyte_buf;
+        if (buf.size() < list_len * 8) {
+            buf.resize(list_len * 8);
+        }
+
+        // (1) read the parameters
+        size_t num_vb_rem = ans_vbyte_decode_u64(in8);
+        size_t num_vb = list_len + num_vb_rem;
+
+        // (2) decode the vbytes
+        decode(in8, buf.data(), num_vb);
+
+        // (3) reassemble the integers
+        const uint8_t* vb_ptr = buf.data();
+        for (size_t i = 0; i < list_len; i++) {
+            *out++ = ans_vbyte_decode_u64(vb_ptr);
+        }
+        return out;
+    }
+};
@@ -91,28 +91,32 @@ inline void ans_vbyte_encode_split_u64(
     }
 }
 
-template <uint32_t t_frame_size = 4096> struct ans_vbyte_single {
+template <uint32_t t_frame_size = 4096, uint32_t t_num_states = 1,
+    class t_model = ans_byte_model<t_frame_size> >
+struct ans_vbyte_single {
+public:
+    /* the vbyte bytes of the list and the reversed rANS output */
+    struct workspace {
+        std::vector<uint8_t> tmp_buf;
+        std::vector<uint8_t> vbyte_buf;
+    };
+
 private:
-    ans_byte_model<t_frame_size> model;
+    t_model model;
+    workspace ws;
 
 private:
-    template <class t_model>
-    void encode(const t_model& m, uint8_t*& out8, uint8_t* buf, size_t n)
+    static void encode(const t_model& m, uint8_t*& out8, uint8_t* buf,
+        size_t n, std::vector<uint8_t>& tmp_buf)
     {
-        static std::vector<uint8_t> tmp_buf;
-        if (tmp_buf.size() < n * 8) {
-            tmp_buf.resize(n * 8);
+        if (tmp_buf.size() < (n + t_num_states) * 8) {
+            tmp_buf.resize((n + t_num_states) * 8);
         }
-        auto state = constants::ANS_START_STATE;
         auto tmp_out_ptr = tmp_buf.data() + tmp_buf.size() - 1;
         auto tmp_out_start = tmp_out_ptr;
-        auto encin = buf + n - 1;
         // we encode the input in reverse order as well
-        for (size_t i = 0; i < n; i++) {
-            uint8_t sym = *encin--;
-            state = m.encode(state, sym, tmp_out_ptr);
-        }
-        m.flush(state, tmp_out_ptr);
+        tmp_out_ptr
+            = m.template encode_block<t_num_states>(buf, n, tmp_out_ptr);
         // as we encoded in reverse order, we have to write in into a tmp
         // buf and then output the written bytes
         size_t enc_size = (tmp_out_start - tmp_out_ptr);
@@ -123,36 +127,39 @@ private:
         out8 += enc_size;
     }
 
-    template <class t_model>
-    void decode(const t_model& m, const uint8_t*& in8, uint8_t* buf, size_t n)
+    static void decode(
+        const t_model& m, const uint8_t*& in8, uint8_t* buf, size_t n)
     {
         size_t enc_size = ans_vbyte_decode_u64(in8);
-        uint32_t state = m.init_decoder(in8, enc_size);
-        for (size_t k = 0; k < n; k++) {
-            *buf++ = m.decode(state, in8, enc_size);
-        }
+        m.template decode_block<t_num_states>(in8, enc_size, buf, n);
     }
 
 public:
     bool required_increasing = false;
     std::string name()
     {
-        return "ans_vbyte_single_" + std::to_string(t_frame_size);
+        std::string suffix = t_model::name_suffix();
+        if (t_num_states != 1)
+            suffix += "_I" + std::to_string(t_num_states);
+        return "ans_vbyte_single_" + std::to_string(t_frame_size) + suffix;
     }
     void init(const list_data& input, uint32_t* out, size_t& nvalue)
     {
-        // (1) count vbyte info
+        // (1) count vbyte info on multiple threads and merge
+        auto part_freqs = parallel_list_stats(input, freq_table{ 0 },
+            [](freq_table& f, const uint32_t* list, size_t n) {
+                for (size_t j = 0; j < n; j++) {
+                    ans_vbyte_freq_count(list[j], f);
+                }
+            });
         freq_table freqs{ 0 };
-        for (size_t i = 0; i < input.num_lists; i++) {
-            const auto& cur_list = input.list_ptrs[i];
-            size_t n = input.list_sizes[i];
-            for (size_t j = 0; j < n; j++) {
-                ans_vbyte_freq_count(cur_list[j], freqs);
-            }
+        for (const auto& f : part_freqs) {
+            for (size_t s = 0; s < freqs.size(); s++)
+                freqs[s] += f[s];
         }
 
         // (2) init model and move
-        model = std::move(ans_byte_model<t_frame_size>(freqs));
+        model = std::move(t_model(freqs));
 
         // (3) write out models
         auto initout8 = reinterpret_cast<uint8_t*>(out);
@@ -171,7 +178,7 @@ public:
     {
         auto initin8 = reinterpret_cast<const uint8_t*>(in);
         auto in8 = initin8;
-        model = ans_byte_model<t_frame_size>(in8);
+        model = t_model(in8);
         size_t pbytes = in8 - initin8;
         if (pbytes % sizeof(uint32_t) != 0) {
             pbytes += sizeof(uint32_t) - (pbytes % (sizeof(uint32_t)));
@@ -182,9 +189,14 @@ public:
 
     void encodeArray(
         const uint32_t* in, const size_t len, uint32_t* out, size_t& nvalue)
+    {
+        encodeArray(in, len, out, nvalue, ws);
+    }
+    void encodeArray(const uint32_t* in, const size_t len, uint32_t* out,
+        size_t& nvalue, workspace& w) const
     {
         // (1) vbyte encode list
-        static std::vector<uint8_t> tmp_vbyte_buf;
+        auto& tmp_vbyte_buf = w.vbyte_buf;
         if (tmp_vbyte_buf.size() < len * 8) {
             tmp_vbyte_buf.resize(len * 8);
         }
@@ -202,7 +214,7 @@ public:
         ans_vbyte_encode_u64(out8, num_vb - len);
 
         // (2) encode the first bytes
-        encode(model, out8, tmp_vbyte_buf.data(), num_vb);
+        encode(model, out8, tmp_vbyte_buf.data(), num_vb, w.tmp_buf);
 
         // (4) align to u32 boundary
         size_t wb = out8 - initout8;
@@ -213,11 +225,16 @@ public:
     }
     uint32_t* decodeArray(
         const uint32_t* in, const size_t len, uint32_t* out, size_t list_len)
+    {
+        return decodeArray(in, len, out, list_len, ws);
+    }
+    uint32_t* decodeArray(const uint32_t* in, const size_t, uint32_t* out,
+        size_t list_len, workspace& w) const
     {
         auto initin8 = reinterpret_cast<const uint8_t*>(in);
         auto in8 = initin8;
 
-        static std::vector<uint8_t> buf;
+        auto& buf = w.vbyte_buf;
         if (buf.size() < list_len * 8) {
             buf.resize(list_len * 8);
         }
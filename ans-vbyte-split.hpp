@@ -2,6 +2,7 @@
 
 #include <cmath>
 #include <memory>
+#include <type_traits>
 
 #include "ans-byte.hpp"
 #include "ans-constants.hpp"
@@ -33,29 +34,43 @@ inline void ans_vbyte_freq_count(uint32_t x, freq_table& first, freq_table& rem)
     }
 }
 
-template <uint32_t t_frame_size = 4096> struct ans_vbyte_split {
+/* with t_fused set decodeArray decodes both streams symbol by symbol and
+   assembles each value as soon as its last byte is decoded, instead of
+   decoding the streams into buffers and stitching them together in a
+   second pass. the encoding is the same either way. fusing needs a model
+   with a per symbol decode (ans_byte_model) and a single state */
+template <uint32_t t_frame_size = 4096, uint32_t t_num_states = 1,
+    class t_model = ans_byte_model<t_frame_size>, bool t_fused = false>
+struct ans_vbyte_split {
+    static_assert(!t_fused || t_num_states == 1,
+        "fused decoding only supports a single state");
+
+public:
+    /* the first and the remaining vbyte bytes of the list and the reversed
+       rANS output */
+    struct workspace {
+        std::vector<uint8_t> tmp_buf;
+        std::vector<uint8_t> first_buf;
+        std::vector<uint8_t> rem_buf;
+    };
+
 private:
-    ans_byte_model<t_frame_size> model_first;
-    ans_byte_model<t_frame_size> model_rem;
+    t_model model_first;
+    t_model model_rem;
+    workspace ws;
 
 private:
-    template <class t_model>
-    void encode(const t_model& m, uint8_t*& out8, uint8_t* buf, size_t n)
+    static void encode(const t_model& m, uint8_t*& out8, uint8_t* buf,
+        size_t n, std::vector<uint8_t>& tmp_buf)
     {
-        static std::vector<uint8_t> tmp_buf;
-        if (tmp_buf.size() < n * 8) {
-            tmp_buf.resize(n * 8);
+        if (tmp_buf.size() < (n + t_num_states) * 8) {
+            tmp_buf.resize((n + t_num_states) * 8);
         }
-        auto state = constants::ANS_START_STATE;
         auto tmp_out_ptr = tmp_buf.data() + tmp_buf.size() - 1;
         auto tmp_out_start = tmp_out_ptr;
-        auto encin = buf + n - 1;
         // we encode the input in reverse order as well
-        for (size_t i = 0; i < n; i++) {
-            uint8_t sym = *encin--;
-            state = m.encode(state, sym, tmp_out_ptr);
-        }
-        m.flush(state, tmp_out_ptr);
+        tmp_out_ptr
+            = m.template encode_block<t_num_states>(buf, n, tmp_out_ptr);
         // as we encoded in reverse order, we have to write in into a tmp
         // buf and then output the written bytes
         size_t enc_size = (tmp_out_start - tmp_out_ptr);
@@ -66,38 +81,116 @@ private:
         out8 += enc_size;
     }
 
-    template <class t_model>
-    void decode(const t_model& m, const uint8_t*& in8, uint8_t* buf, size_t n)
+    static void decode(
+        const t_model& m, const uint8_t*& in8, uint8_t* buf, size_t n)
     {
         size_t enc_size = ans_vbyte_decode_u64(in8);
-        uint32_t state = m.init_decoder(in8, enc_size);
-        for (size_t k = 0; k < n; k++) {
-            *buf++ = m.decode(state, in8, enc_size);
+        m.template decode_block<t_num_states>(in8, enc_size, buf, n);
+    }
+
+    /* decode the two streams into w and stitch them together into out */
+    uint32_t* decode_values(const uint8_t* in8, size_t num_vb_rem,
+        uint32_t* out, size_t list_len, workspace& w, std::false_type) const
+    {
+        size_t num_vb = list_len;
+        auto& first_buf = w.first_buf;
+        auto& rem_buf = w.rem_buf;
+        if (first_buf.size() < num_vb) {
+            first_buf.resize(num_vb);
         }
+        if (rem_buf.size() < num_vb_rem) {
+            rem_buf.resize(num_vb_rem);
+        }
+
+        // (2) decode the two streams
+        decode(model_first, in8, first_buf.data(), num_vb);
+        decode(model_rem, in8, rem_buf.data(), num_vb_rem);
+
+        // (3) stitch them back together to create the output
+        size_t first_offset = 0;
+        size_t rem_offset = 0;
+        for (size_t i = 0; i < list_len; i++) {
+            auto cur_first = first_buf[first_offset++];
+            if (cur_first < 128) {
+                *out++ = uint32_t(cur_first);
+            } else {
+                uint32_t num = cur_first & 127;
+                auto cur_rem = rem_buf[rem_offset++];
+                uint8_t shift = 7;
+                while (cur_rem > 127) {
+                    num = num + ((cur_rem & 127) << shift);
+                    cur_rem = rem_buf[rem_offset++];
+                    shift += 7;
+                }
+                num = num + (cur_rem << shift);
+                *out++ = num;
+            }
+        }
+
+        return out;
+    }
+
+    /* fused decoding of the two streams into out */
+    uint32_t* decode_values(const uint8_t* in8, size_t, uint32_t* out,
+        size_t list_len, workspace&, std::true_type) const
+    {
+        // (2) find the start of both streams
+        size_t first_size = ans_vbyte_decode_u64(in8);
+        const uint8_t* in_first = in8;
+        const uint8_t* in_rem = in8 + first_size;
+        size_t rem_size = ans_vbyte_decode_u64(in_rem);
+        uint32_t state_first = model_first.init_decoder(in_first, first_size);
+        uint32_t state_rem = model_rem.init_decoder(in_rem, rem_size);
+
+        // (3) pull the remaining bytes of a value right after its first
+        for (size_t i = 0; i < list_len; i++) {
+            uint8_t b = model_first.decode(state_first, in_first, first_size);
+            uint32_t num = b & 127;
+            uint32_t shift = 7;
+            while (b > 127) {
+                b = model_rem.decode(state_rem, in_rem, rem_size);
+                num += uint32_t(b & 127) << shift;
+                shift += 7;
+            }
+            *out++ = num;
+        }
+        return out;
     }
 
 public:
     bool required_increasing = false;
     std::string name()
     {
-        return "ans_vbyte_split_" + std::to_string(t_frame_size);
+        std::string suffix = t_model::name_suffix();
+        if (t_num_states != 1)
+            suffix += "_I" + std::to_string(t_num_states);
+        if (t_fused)
+            suffix += "_F";
+        return "ans_vbyte_split_" + std::to_string(t_frame_size) + suffix;
     }
     void init(const list_data& input, uint32_t* out, size_t& nvalue)
     {
-        // (1) count vbyte info
+        // (1) count vbyte info on multiple threads and merge
+        using split_freqs = std::pair<freq_table, freq_table>;
+        auto part_freqs = parallel_list_stats(input,
+            split_freqs{ freq_table{ 0 }, freq_table{ 0 } },
+            [](split_freqs& f, const uint32_t* list, size_t n) {
+                for (size_t j = 0; j < n; j++) {
+                    ans_vbyte_freq_count(list[j], f.first, f.second);
+                }
+            });
         freq_table freqs_first{ 0 };
         freq_table freqs_rem{ 0 };
-        for (size_t i = 0; i < input.num_lists; i++) {
-            const auto& cur_list = input.list_ptrs[i];
-            size_t n = input.list_sizes[i];
-            for (size_t j = 0; j < n; j++) {
-                ans_vbyte_freq_count(cur_list[j], freqs_first, freqs_rem);
+        for (const auto& f : part_freqs) {
+            for (size_t s = 0; s < freqs_first.size(); s++) {
+                freqs_first[s] += f.first[s];
+                freqs_rem[s] += f.second[s];
             }
         }
 
         // (2) init model and move
-        model_first = std::move(ans_byte_model<t_frame_size>(freqs_first));
-        model_rem = std::move(ans_byte_model<t_frame_size>(freqs_rem));
+        model_first = std::move(t_model(freqs_first));
+        model_rem = std::move(t_model(freqs_rem));
 
         // (3) write out models
         auto initout8 = reinterpret_cast<uint8_t*>(out);
@@ -117,8 +210,8 @@ public:
     {
         auto initin8 = reinterpret_cast<const uint8_t*>(in);
         auto in8 = initin8;
-        model_first = ans_byte_model<t_frame_size>(in8);
-        model_rem = ans_byte_model<t_frame_size>(in8);
+        model_first = t_model(in8);
+        model_rem = t_model(in8);
         size_t pbytes = in8 - initin8;
         if (pbytes % sizeof(uint32_t) != 0) {
             pbytes += sizeof(uint32_t) - (pbytes % (sizeof(uint32_t)));
@@ -129,12 +222,19 @@ public:
 
     void encodeArray(
         const uint32_t* in, const size_t len, uint32_t* out, size_t& nvalue)
+    {
+        encodeArray(in, len, out, nvalue, ws);
+    }
+    void encodeArray(const uint32_t* in, const size_t len, uint32_t* out,
+        size_t& nvalue, workspace& w) const
     {
         // (1) vbyte encode list
-        static std::vector<uint8_t> tmp_vbyte_first_buf;
-        static std::vector<uint8_t> tmp_vbyte_rem_buf;
+        auto& tmp_vbyte_first_buf = w.first_buf;
+        auto& tmp_vbyte_rem_buf = w.rem_buf;
         if (tmp_vbyte_first_buf.size() < len * 8) {
             tmp_vbyte_first_buf.resize(len * 8);
+        }
+        if (tmp_vbyte_rem_buf.size() < len * 8) {
             tmp_vbyte_rem_buf.resize(len * 8);
         }
 
@@ -153,10 +253,12 @@ public:
         ans_vbyte_encode_u64(out8, num_vb_rem);
 
         // (2) encode the first bytes
-        encode(model_first, out8, tmp_vbyte_first_buf.data(), num_vb_first);
+        encode(model_first, out8, tmp_vbyte_first_buf.data(), num_vb_first,
+            w.tmp_buf);
 
         // (3) encode the second bytes
-        encode(model_rem, out8, tmp_vbyte_rem_buf.data(), num_vb_rem);
+        encode(model_rem, out8, tmp_vbyte_rem_buf.data(), num_vb_rem,
+            w.tmp_buf);
 
         // (4) align to u32 boundary
         size_t wb = out8 - initout8;
@@ -168,45 +270,17 @@ public:
     uint32_t* decodeArray(
         const uint32_t* in, const size_t len, uint32_t* out, size_t list_len)
     {
-        static std::vector<uint8_t> first_buf;
-        static std::vector<uint8_t> rem_buf;
-        if (first_buf.size() < list_len) {
-            first_buf.resize(list_len);
-            rem_buf.resize(list_len);
-        }
-
+        return decodeArray(in, len, out, list_len, ws);
+    }
+    uint32_t* decodeArray(const uint32_t* in, const size_t, uint32_t* out,
+        size_t list_len, workspace& w) const
+    {
         auto initin8 = reinterpret_cast<const uint8_t*>(in);
         auto in8 = initin8;
 
         // (1) read the parameters
         size_t num_vb_rem = ans_vbyte_decode_u64(in8);
-        size_t num_vb = list_len;
-
-        // (2) decode the two streams
-        decode(model_first, in8, first_buf.data(), num_vb);
-        decode(model_rem, in8, rem_buf.data(), num_vb_rem);
-
-        // (3) stitch them back together to create the output
-        size_t first_offset = 0;
-        size_t rem_offset = 0;
-        for (size_t i = 0; i < list_len; i++) {
-            auto cur_first = first_buf[first_offset++];
-            if (cur_first < 128) {
-                *out++ = uint32_t(cur_first);
-            } else {
-                uint32_t num = cur_first & 127;
-                auto cur_rem = rem_buf[rem_offset++];
-                uint8_t shift = 7;
-                while (cur_rem > 127) {
-                    num = num + ((cur_rem & 127) << shift);
-                    cur_rem = rem_buf[rem_offset++];
-                    shift += 7;
-                }
-                num = num + (cur_rem << shift);
-                *out++ = num;
-            }
-        }
-
-        return out;
+        return decode_values(in8, num_vb_rem, out, list_len, w,
+            std::integral_constant<bool, t_fused>());
     }
 };
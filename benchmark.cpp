@@ -1,12 +1,109 @@
 #include <iostream>
+#include <random>
 #include <vector>
 
+#include "codec-registry.hpp"
+#include "cursor.hpp"
 #include "cutil.hpp"
+#include "index-reader.hpp"
 #include "methods.hpp"
 #include "util.hpp"
 
 using encoding_stats = std::pair<std::chrono::nanoseconds, uint64_t>;
 
+/* space reserved for the models written by init(). they are a few KB */
+const size_t MAX_MODEL_U32 = 1 << 20;
+
+/* ask for transparent huge pages when mapping the encoded lists */
+bool mmap_huge_pages = false;
+
+/* term ids of the queries of a query log. empty unless one was given */
+std::vector<std::vector<uint32_t> > query_log;
+
+/* untimed and timed passes over all lists when measuring decoding */
+size_t warmup_passes = 0;
+size_t timed_passes = 1;
+
+/* flush the cpu caches before every decode pass */
+bool flush_between_passes = false;
+
+/* evict the cpu caches by streaming over more memory than the last level
+   cache holds */
+void flush_cpu_caches()
+{
+    static std::vector<uint64_t> buf((64 << 20) / sizeof(uint64_t));
+    for (auto& x : buf)
+        x++;
+}
+
+/* one line of results per codec, part, thread count and repetition */
+struct run_result {
+    std::string col_name;
+    std::string part;
+    std::string method;
+    size_t threads;
+    size_t rep;
+    uint64_t postings;
+    uint64_t lists;
+    uint64_t size_bits;
+    uint64_t skip_bits;
+    uint64_t encoding_time_ns;
+    uint64_t model_init_time_ns;
+    /* median, min and standard deviation of the timed decode passes */
+    uint64_t decoding_time_ns;
+    uint64_t decoding_min_ns;
+    double decoding_stddev_ns;
+};
+
+/* results are written to stdout as csv (the default) or json lines */
+bool output_json = false;
+
+void print_result_header()
+{
+    if (!output_json) {
+        printf("col;part;method;threads;rep;postings;lists;size_bits;"
+               "skip_bits;encoding_time_ns;model_init_time_ns;"
+               "decoding_time_ns;decoding_min_ns;decoding_stddev_ns\n");
+        fflush(stdout);
+    }
+}
+
+void print_result(const run_result& r)
+{
+    if (output_json) {
+        printf("{\"col\": \"%s\", \"part\": \"%s\", \"method\": \"%s\", "
+               "\"threads\": %lu, \"rep\": %lu, \"postings\": %lu, "
+               "\"lists\": %lu, \"size_bits\": %lu, \"skip_bits\": %lu, "
+               "\"encoding_time_ns\": %lu, \"model_init_time_ns\": %lu, "
+               "\"decoding_time_ns\": %lu, \"decoding_min_ns\": %lu, "
+               "\"decoding_stddev_ns\": %.0f}\n",
+            r.col_name.c_str(), r.part.c_str(), r.method.c_str(), r.threads,
+            r.rep, r.postings, r.lists, r.size_bits, r.skip_bits,
+            r.encoding_time_ns, r.model_init_time_ns, r.decoding_time_ns,
+            r.decoding_min_ns, r.decoding_stddev_ns);
+    } else {
+        printf("%s;%s;%s;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%.0f\n",
+            r.col_name.c_str(), r.part.c_str(), r.method.c_str(), r.threads,
+            r.rep, r.postings, r.lists, r.size_bits, r.skip_bits,
+            r.encoding_time_ns, r.model_init_time_ns, r.decoding_time_ns,
+            r.decoding_min_ns, r.decoding_stddev_ns);
+    }
+    fflush(stdout);
+}
+
+/* bytes of a list encoding spent on skip tables. they are part of the
+   encoded size but also reported on their own */
+template <class t_compressor> struct skip_table_size {
+    static size_t bytes(size_t) { return 0; }
+};
+template <uint32_t t_bs, bool t_skips>
+struct skip_table_size<ans_packed<t_bs, t_skips> > {
+    static size_t bytes(size_t list_len)
+    {
+        return ans_packed<t_bs, t_skips>::skip_table_bytes(list_len);
+    }
+};
+
 template <class t_compressor>
 encoding_stats compress_lists(const list_data& ld, std::string out_prefix,
     std::string col_name, std::string part)
@@ -28,45 +125,34 @@ encoding_stats compress_lists(const list_data& ld, std::string out_prefix,
 
     {
         auto out_file = fopen_or_fail(output_data_filename, "wb");
-        // allocate a lage output buffer
-        std::vector<uint32_t> out_buf(local_data.num_postings * 1.5);
-        std::vector<uint64_t> list_starts(local_data.num_lists + 1);
 
-        uint32_t* initout = out_buf.data();
-        uint64_t total_u32_written = 0;
+        // (1) encode the lists on multiple threads. each thread writes its
+        // own buffer and the buffers are concatenated in order, so the
+        // output does not depend on the number of threads
+        size_t threads = num_threads();
+        if (!encodes_position_independent<t_compressor>::value)
+            threads = 1;
+        std::vector<uint32_t> model_buf(MAX_MODEL_U32);
+        size_t model_u32 = 0;
+        encoded_parts enc;
         {
             timer t("encode lists");
             auto start = std::chrono::high_resolution_clock::now();
-
-            uint32_t* out = initout;
-
-            {
-                size_t encoded_u32 = 0;
-                comp.init(ld, out, encoded_u32);
-                out += encoded_u32;
-                total_u32_written += encoded_u32;
-            }
-
-            for (size_t i = 0; i < local_data.num_lists; i++) {
-                size_t list_size = local_data.list_sizes[i];
-                const uint32_t* in = local_data.list_ptrs[i];
-                list_starts[i] = (out - initout);
-                size_t encoded_u32 = local_data.num_postings;
-                comp.encodeArray(in, list_size, out, encoded_u32);
-                out += encoded_u32;
-                total_u32_written += encoded_u32;
-            }
-            list_starts[local_data.num_lists] = (out - initout);
+            comp.init(ld, model_buf.data(), model_u32);
+            enc = encode_lists(comp, local_data, threads, model_u32);
             auto stop = std::chrono::high_resolution_clock::now();
             encoding_time_ns = stop - start;
         }
-        write_u32s(out_file, initout, total_u32_written);
+        write_u32s(out_file, model_buf.data(), model_u32);
+        for (size_t p = 0; p < enc.bufs.size(); p++) {
+            write_u32s(out_file, enc.bufs[p].data(), enc.u32s[p]);
+        }
         fclose(out_file);
 
         {
             timer t("write meta data");
-            auto meta_file = fopen_or_fail(metadata_filename, "w");
-            write_metadata(meta_file, local_data, list_starts);
+            auto meta_file = fopen_or_fail(metadata_filename, "wb");
+            write_metadata(meta_file, local_data, enc.list_starts);
             fclose(meta_file);
         }
     }
@@ -80,8 +166,15 @@ encoding_stats compress_lists(const list_data& ld, std::string out_prefix,
     return { encoding_time_ns, size_bits };
 }
 
+/* model construction time and the times of the timed decode passes in
+   increasing order */
+struct decode_stats {
+    std::chrono::nanoseconds model_init_ns;
+    std::vector<std::chrono::nanoseconds> pass_ns;
+};
+
 template <class t_compressor>
-std::chrono::nanoseconds decompress_and_verify(const list_data& original,
+decode_stats decompress_and_verify(const list_data& original,
     std::string prefix, std::string col_name, std::string part)
 {
     t_compressor comp;
@@ -91,49 +184,47 @@ std::chrono::nanoseconds decompress_and_verify(const list_data& original,
     std::string metadata_filename = input_method_prefix + ".metadata";
     std::cerr << "input_filename = " << input_data_filename << std::endl;
     std::cerr << "metadata_filename = " << metadata_filename << std::endl;
-    std::chrono::nanoseconds decoding_time_ns;
+    decode_stats stats;
 
-    // (1) read metadata and allocate buffers
+    // (1) allocate buffers
     list_data recovered;
-    std::vector<uint64_t> list_starts;
     {
-        timer t("read meta data");
-        auto meta_file = fopen_or_fail(metadata_filename, "r");
-        read_metadata(meta_file, recovered, list_starts);
-        fclose(meta_file);
+        timer t("allocate lists");
+        recovered = alloc_lists(list_directory(metadata_filename));
     }
 
-    // (2) decompress
-    {
-        auto in_file = fopen_or_fail(input_data_filename, "rb");
-        auto content = read_file_content_u32(in_file);
-        fclose(in_file);
-        const uint32_t* in = content.data();
-        {
-            timer t("decode lists");
-
-            auto start = std::chrono::high_resolution_clock::now();
-            {
-                comp.dec_init(in);
-            }
+    // (2) map the file and build the models. we decode every list so ask
+    // the kernel to read ahead
+    auto start = std::chrono::high_resolution_clock::now();
+    index_reader<t_compressor> reader(
+        input_method_prefix, true, mmap_huge_pages);
+    auto stop = std::chrono::high_resolution_clock::now();
+    stats.model_init_ns = stop - start;
 
+    // (3) untimed warm-up passes followed by the timed passes
+    {
+        timer t("decode lists");
+        if (pin_threads())
+            pin_current_thread(0);
+        for (size_t pass = 0; pass < warmup_passes + timed_passes; pass++) {
+            if (flush_between_passes)
+                flush_cpu_caches();
+            start = std::chrono::high_resolution_clock::now();
             for (size_t i = 0; i < recovered.num_lists; i++) {
-                auto input_ptr = in + list_starts[i];
-                size_t encoding_size_u32 = list_starts[i + 1] - list_starts[i];
-                comp.decodeArray(input_ptr, encoding_size_u32,
-                    recovered.list_ptrs[i], recovered.list_sizes[i]);
+                reader.decode_list(i, recovered.list_ptrs[i]);
             }
-
-            auto stop = std::chrono::high_resolution_clock::now();
-            decoding_time_ns = stop - start;
+            stop = std::chrono::high_resolution_clock::now();
+            if (pass >= warmup_passes)
+                stats.pass_ns.push_back(stop - start);
         }
+        std::sort(stats.pass_ns.begin(), stats.pass_ns.end());
     }
 
     if (comp.required_increasing) {
         undo_prefix_sum_lists(recovered);
     }
 
-    // (3) verify
+    // (4) verify the output of the last pass
     {
         timer t("verify encode/decode");
         REQUIRE_EQUAL(original.num_lists, recovered.num_lists, "num_lists");
@@ -147,36 +238,365 @@ std::chrono::nanoseconds decompress_and_verify(const list_data& original,
                 "list_contents[" + std::to_string(i) + "]");
         }
     }
-    return decoding_time_ns;
+    return stats;
+}
+
+/* decode randomly picked single lists through an index_reader as a query
+   would and report the mean latency per list */
+template <class t_compressor>
+void random_access(std::string prefix, std::string col_name, std::string part)
+{
+    const size_t num_accesses = 10000;
+    t_compressor comp;
+    std::string input_method_prefix
+        = prefix + "/" + col_name + "-" + part + "." + comp.name();
+    index_reader<t_compressor> reader(input_method_prefix);
+    if (reader.num_lists() == 0)
+        return;
+
+    uint32_t max_len = 0;
+    for (size_t i = 0; i < reader.num_lists(); i++) {
+        max_len = std::max(max_len, reader.list_len(i));
+    }
+    std::vector<uint32_t> out(max_len + LIST_OUT_PADDING / sizeof(uint32_t));
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<size_t> term_dist(
+        0, reader.num_lists() - 1);
+    uint64_t postings = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < num_accesses; i++) {
+        postings += reader.decode_list(term_dist(gen), out.data());
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+
+    std::chrono::nanoseconds time_ns = stop - start;
+    fprintff(stderr, "random access %s;%s;%s;lists=%lu;postings=%lu;"
+                     "avg_us=%.2f\n",
+        col_name.c_str(), part.c_str(), comp.name().c_str(), num_accesses,
+        postings, time_ns.count() / 1000.0 / num_accesses);
 }
 
+/* run random AND queries of num_terms terms over the docid lists through
+   posting cursors, check the results against std::set_intersection over
+   the uncompressed lists and report the queries per second */
 template <class t_compressor>
-void run(const list_data& inputs, std::string out_prefix, std::string col_name,
-    std::string part)
+void intersection_speed(const list_data& docids, std::string prefix,
+    std::string col_name, size_t num_terms)
+{
+    const size_t num_queries = 1000;
+    t_compressor comp;
+    std::string input_method_prefix
+        = prefix + "/" + col_name + "-docids." + comp.name();
+    index_reader<t_compressor> reader(input_method_prefix);
+    if (reader.num_lists() == 0)
+        return;
+
+    // (1) pick the queries and compute the expected results
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<size_t> term_dist(
+        0, reader.num_lists() - 1);
+    std::vector<std::vector<size_t> > queries(num_queries);
+    std::vector<size_t> expected(num_queries);
+    for (size_t q = 0; q < num_queries; q++) {
+        std::vector<uint32_t> res;
+        for (size_t t = 0; t < num_terms; t++) {
+            size_t term_id = term_dist(gen);
+            queries[q].push_back(term_id);
+            std::vector<uint32_t> list(docids.list_ptrs[term_id],
+                docids.list_ptrs[term_id] + docids.list_sizes[term_id]);
+            std::partial_sum(list.begin(), list.end(), list.begin());
+            if (t == 0) {
+                res = list;
+                continue;
+            }
+            std::vector<uint32_t> both;
+            std::set_intersection(res.begin(), res.end(), list.begin(),
+                list.end(), std::back_inserter(both));
+            res.swap(both);
+        }
+        expected[q] = res.size();
+    }
+
+    // (2) run them
+    using cursor_type = posting_cursor<t_compressor>;
+    typename t_compressor::workspace ws;
+    std::vector<uint32_t> out(docids.num_postings + 1);
+    std::vector<size_t> found(num_queries);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t q = 0; q < num_queries; q++) {
+        std::vector<cursor_type> cursors;
+        cursors.reserve(num_terms);
+        for (auto term_id : queries[q]) {
+            cursors.emplace_back(reader, term_id, ws);
+        }
+        std::vector<cursor_type*> ptrs;
+        for (auto& c : cursors) {
+            ptrs.push_back(&c);
+        }
+        found[q] = intersect(ptrs, out.data());
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+
+    uint64_t results = 0;
+    for (size_t q = 0; q < num_queries; q++) {
+        REQUIRE_EQUAL(expected[q], found[q],
+            "intersection size of query " + std::to_string(q));
+        results += found[q];
+    }
+    std::chrono::nanoseconds time_ns = stop - start;
+    fprintff(stderr, "intersect %s;%s;terms=%lu;queries=%lu;results=%lu;"
+                     "queries_per_sec=%.0f\n",
+        col_name.c_str(), comp.name().c_str(), num_terms, num_queries,
+        results, num_queries / (time_ns.count() / 1e9));
+}
+
+/* q-quantile of the sorted latencies */
+double latency_us(const std::vector<std::chrono::nanoseconds>& sorted, double q)
 {
+    size_t i = std::min(sorted.size() - 1, size_t(q * sorted.size()));
+    return sorted[i].count() / 1000.0;
+}
+
+/* decode the lists of each query of the query log and report the
+   percentiles of the per query decoding time. warm runs go over the log
+   once before measuring, cold runs evict the index from the page cache
+   and the cpu caches before every query */
+template <class t_compressor>
+void query_latency(
+    std::string prefix, std::string col_name, std::string part, bool cold)
+{
+    t_compressor comp;
+    std::string input_method_prefix
+        = prefix + "/" + col_name + "-" + part + "." + comp.name();
+    index_reader<t_compressor> reader(input_method_prefix);
+
+    uint32_t max_len = 0;
+    for (size_t i = 0; i < reader.num_lists(); i++) {
+        max_len = std::max(max_len, reader.list_len(i));
+    }
+    std::vector<uint32_t> out(max_len + LIST_OUT_PADDING / sizeof(uint32_t));
+
+    if (!cold) {
+        for (const auto& query : query_log) {
+            for (auto term_id : query)
+                reader.decode_list(term_id, out.data());
+        }
+    }
+    std::vector<std::chrono::nanoseconds> latencies;
+    for (const auto& query : query_log) {
+        if (cold) {
+            reader.evict_caches();
+            flush_cpu_caches();
+        }
+        auto start = std::chrono::high_resolution_clock::now();
+        for (auto term_id : query)
+            reader.decode_list(term_id, out.data());
+        auto stop = std::chrono::high_resolution_clock::now();
+        latencies.push_back(stop - start);
+    }
+    std::sort(latencies.begin(), latencies.end());
+    fprintff(stderr, "query latency %s;%s;%s;%s;queries=%lu;p50_us=%.2f;"
+                     "p99_us=%.2f;p999_us=%.2f\n",
+        col_name.c_str(), part.c_str(), comp.name().c_str(),
+        cold ? "cold" : "warm", latencies.size(), latency_us(latencies, 0.5),
+        latency_us(latencies, 0.99), latency_us(latencies, 0.999));
+}
+
+template <class t_compressor>
+run_result run(const list_data& inputs, std::string out_prefix,
+    std::string col_name, std::string part)
+{
+    ans_stats_reset();
     auto estats
         = compress_lists<t_compressor>(inputs, out_prefix, col_name, part);
-    auto dtime_ns = decompress_and_verify<t_compressor>(
+    auto dstats = decompress_and_verify<t_compressor>(
         inputs, out_prefix, col_name, part);
 
+    run_result res;
     {
         t_compressor c;
-        fprintff(stderr, "%s;%s;%s;%lu;%lu;%lu;%lu;%lu\n", col_name.c_str(),
-            part.c_str(), c.name().c_str(), inputs.num_postings,
-            inputs.num_lists, estats.second, estats.first.count(),
-            dtime_ns.count());
+        res.col_name = col_name;
+        res.part = part;
+        res.method = c.name();
+        res.threads = num_threads();
+        res.rep = 0;
+        res.postings = inputs.num_postings;
+        res.lists = inputs.num_lists;
+        res.size_bits = estats.second;
+        res.encoding_time_ns = estats.first.count();
+        res.model_init_time_ns = dstats.model_init_ns.count();
+
+        // (1) summarize the decode passes
+        const auto& passes = dstats.pass_ns;
+        double mean = 0;
+        for (auto p : passes)
+            mean += p.count();
+        mean /= passes.size();
+        double var = 0;
+        for (auto p : passes)
+            var += (p.count() - mean) * (p.count() - mean);
+        res.decoding_time_ns = passes[passes.size() / 2].count();
+        res.decoding_min_ns = passes[0].count();
+        res.decoding_stddev_ns = std::sqrt(var / passes.size());
+        double n = inputs.num_postings;
+        fprintff(stderr,
+            "decode %s;%s;%s;passes=%lu;init_ns=%lu;min_ns_per_int=%.3f;"
+            "median_ns_per_int=%.3f;stddev_ns_per_int=%.3f;median_mb_s=%.1f;"
+            "bpi=%.3f\n",
+            col_name.c_str(), part.c_str(), c.name().c_str(), passes.size(),
+            res.model_init_time_ns, res.decoding_min_ns / n,
+            res.decoding_time_ns / n, res.decoding_stddev_ns / n,
+            n * sizeof(uint32_t) / (res.decoding_time_ns / 1e3),
+            res.size_bits / n);
 
         double BPI = double(estats.second) / double(inputs.num_postings);
         std::cerr << col_name << " - " << part << " - " << c.name() << " - "
                   << BPI << std::endl;
+
+        uint64_t skip_bits = 0;
+        for (size_t i = 0; i < inputs.num_lists; i++) {
+            skip_bits += skip_table_size<t_compressor>::bytes(
+                             inputs.list_sizes[i])
+                * 8;
+        }
+        if (skip_bits != 0) {
+            fprintff(stderr, "skips %s;%s;%s;skip_bits=%lu;skip_bpi=%.3f\n",
+                col_name.c_str(), part.c_str(), c.name().c_str(), skip_bits,
+                double(skip_bits) / double(inputs.num_postings));
+        }
+        res.skip_bits = skip_bits;
+        ans_stats_print(stderr, col_name + ";" + part + ";" + c.name());
+    }
+
+    random_access<t_compressor>(out_prefix, col_name, part);
+    if (!query_log.empty()) {
+        query_latency<t_compressor>(out_prefix, col_name, part, false);
+        query_latency<t_compressor>(out_prefix, col_name, part, true);
+    }
+    return res;
+}
+
+/* benchmarks of one codec configuration, looked up by name */
+struct codec_entry {
+    std::string name;
+    run_result (*run)(const list_data&, std::string, std::string, std::string);
+    void (*intersect)(const list_data&, std::string, std::string, size_t);
+};
+
+struct codec_registrar {
+    std::vector<codec_entry> codecs;
+    template <class t_compressor> void add()
+    {
+        codecs.push_back(codec_entry{ t_compressor().name(),
+            &run<t_compressor>, &intersection_speed<t_compressor> });
+    }
+};
+
+std::vector<codec_entry> all_codecs()
+{
+    codec_registrar r;
+    visit_codecs(r);
+    return r.codecs;
+}
+
+/* encode the vbyte bytes of all lists once with the division based rANS
+   state transform and once with the reciprocal based one used by
+   ans_byte_model::encode, check the outputs match and report the speedup */
+void encode_speedup(
+    const list_data& ld, std::string col_name, std::string part)
+{
+    using model_type = ans_byte_model<4096>;
+    freq_table freqs{ 0 };
+    std::vector<uint8_t> vbytes(ld.num_postings * 5);
+    auto vb_ptr = vbytes.data();
+    for (size_t i = 0; i < ld.num_lists; i++) {
+        for (size_t j = 0; j < ld.list_sizes[i]; j++) {
+            ans_vbyte_freq_count(ld.list_ptrs[i][j], freqs);
+            ans_vbyte_encode_u64(vb_ptr, ld.list_ptrs[i][j]);
+        }
+    }
+    size_t n = vb_ptr - vbytes.data();
+    model_type m(freqs);
+
+    std::vector<uint8_t> out_div(n * 2 + 16);
+    std::vector<uint8_t> out_rcp(n * 2 + 16);
+    uint8_t* div_ptr = out_div.data() + out_div.size();
+    uint8_t* rcp_ptr = out_rcp.data() + out_rcp.size();
+
+    auto start = std::chrono::high_resolution_clock::now();
+    uint32_t state = constants::ANS_START_STATE;
+    for (size_t i = n; i != 0; i--) {
+        uint8_t sym = vbytes[i - 1];
+        uint32_t f = m.normalized_freqs[sym];
+        while (state >= m.sym_upper_bound[sym]) {
+            *--div_ptr = (uint8_t)(state & 0xFF);
+            state = state >> constants::OUTPUT_BASE_LOG2;
+        }
+        state = ((state / f) * m.M) + (state % f) + m.base[sym];
+    }
+    m.flush(state, div_ptr);
+    auto mid = std::chrono::high_resolution_clock::now();
+    rcp_ptr = m.encode_block<1>(vbytes.data(), n, rcp_ptr);
+    auto stop = std::chrono::high_resolution_clock::now();
+
+    size_t div_bytes = out_div.data() + out_div.size() - div_ptr;
+    size_t rcp_bytes = out_rcp.data() + out_rcp.size() - rcp_ptr;
+    REQUIRE_EQUAL(div_bytes, rcp_bytes, "encoding size");
+    REQUIRE_EQUAL(memcmp(div_ptr, rcp_ptr, div_bytes), 0, "encoding");
+    std::chrono::nanoseconds div_ns = mid - start;
+    std::chrono::nanoseconds rcp_ns = stop - mid;
+    fprintff(stderr, "encode speedup %s;%s;div_ns=%lu;rcp_ns=%lu;%.2fx\n",
+        col_name.c_str(), part.c_str(), div_ns.count(), rcp_ns.count(),
+        double(div_ns.count()) / double(rcp_ns.count()));
+}
+
+std::vector<std::string> split_names(std::string names)
+{
+    std::vector<std::string> res;
+    size_t start = 0;
+    while (start <= names.size()) {
+        size_t end = names.find(',', start);
+        if (end == std::string::npos)
+            end = names.size();
+        if (end != start)
+            res.push_back(names.substr(start, end - start));
+        start = end + 1;
     }
+    return res;
+}
+
+void print_usage(const char* prog)
+{
+    fprintff(stderr,
+        "%s <colname> <input_prefix> <output_path> [options]\n"
+        "  --codecs <a,b,..>     codecs to run (default: all)\n"
+        "  --parts <a,b>         docids and/or freqs (default: both)\n"
+        "  --reps <n>            repetitions of each run (default: 1)\n"
+        "  --threads <a,b,..>    encoding thread counts (default: all cores)\n"
+        "  --warmup <n>          untimed decode passes (default: 0)\n"
+        "  --trials <n>          timed decode passes (default: 1)\n"
+        "  --pin                 pin threads to cpus\n"
+        "  --flush               flush the cpu caches before decode passes\n"
+        "  --format <csv|json>   result format on stdout (default: csv)\n"
+        "  --queries <file>      report query log decode latencies\n"
+        "  --intersect           report intersection speed on docids\n"
+        "  --encode-speedup      compare division and reciprocal encoding\n"
+        "  --huge-pages          map encoded lists with huge pages\n"
+        "%s --list-codecs\n",
+        prog, prog);
 }
 
 int main(int argc, char const* argv[])
 {
-    if (argc < 3) {
-        fprintff(
-            stderr, "%s <colname> <input_prefix> <output_path>\n", argv[0]);
+    auto codecs = all_codecs();
+    if (argc == 2 && std::string(argv[1]) == "--list-codecs") {
+        for (const auto& c : codecs)
+            printf("%s\n", c.name.c_str());
+        return EXIT_SUCCESS;
+    }
+    if (argc < 4) {
+        print_usage(argv[0]);
         return EXIT_FAILURE;
     }
 
@@ -184,33 +604,113 @@ int main(int argc, char const* argv[])
     std::string input_prefix = argv[2];
     std::string out_prefix = argv[3];
 
+    // (1) parse the options
+    std::vector<std::string> codec_names;
+    std::vector<std::string> parts = { "docids", "freqs" };
+    std::vector<size_t> thread_counts = { num_threads() };
+    size_t reps = 1;
+    bool intersect = false;
+    bool speedup = false;
+    std::string query_log_file;
+    for (int i = 4; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--codecs" && has_value) {
+            codec_names = split_names(argv[++i]);
+        } else if (arg == "--parts" && has_value) {
+            parts = split_names(argv[++i]);
+        } else if (arg == "--warmup" && has_value) {
+            warmup_passes = std::max(0, atoi(argv[++i]));
+        } else if (arg == "--trials" && has_value) {
+            timed_passes = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--pin") {
+            pin_threads() = true;
+        } else if (arg == "--flush") {
+            flush_between_passes = true;
+        } else if (arg == "--reps" && has_value) {
+            reps = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--threads" && has_value) {
+            thread_counts.clear();
+            for (const auto& t : split_names(argv[++i]))
+                thread_counts.push_back(std::max(1, atoi(t.c_str())));
+        } else if (arg == "--format" && has_value) {
+            std::string format = argv[++i];
+            if (format != "csv" && format != "json")
+                quit("unknown result format %s", format.c_str());
+            output_json = format == "json";
+        } else if (arg == "--queries" && has_value) {
+            query_log_file = argv[++i];
+        } else if (arg == "--intersect") {
+            intersect = true;
+        } else if (arg == "--encode-speedup") {
+            speedup = true;
+        } else if (arg == "--huge-pages") {
+            mmap_huge_pages = true;
+        } else if (!arg.empty() && isdigit(arg[0])) {
+            thread_counts = { size_t(std::max(1, atoi(arg.c_str()))) };
+        } else {
+            print_usage(argv[0]);
+            quit("unknown option %s", arg.c_str());
+        }
+    }
+    for (const auto& part : parts) {
+        if (part != "docids" && part != "freqs")
+            quit("unknown part %s", part.c_str());
+    }
+    std::vector<codec_entry> selected;
+    if (codec_names.empty())
+        selected = codecs;
+    for (const auto& name : codec_names) {
+        auto it = std::find_if(codecs.begin(), codecs.end(),
+            [&](const codec_entry& c) { return c.name == name; });
+        if (it == codecs.end())
+            quit("unknown codec %s. see --list-codecs", name.c_str());
+        selected.push_back(*it);
+    }
+
+    // (2) load the inputs
     auto inputs = read_all_input_ds2i(input_prefix);
+    if (!query_log_file.empty()) {
+        query_log = read_query_log(query_log_file);
+        for (const auto& query : query_log) {
+            for (auto term_id : query) {
+                if (term_id >= inputs.docids.num_lists)
+                    quit("query term id %u out of range", term_id);
+            }
+        }
+    }
 
-    fprintff(stderr,
-        "col;part;method;postings;lists;size_bits;encoding_time_ns;"
-        "decoding_time_ns\n");
-
-    run<qmx>(inputs.docids, out_prefix, col_name, "docids");
-    run<qmx>(inputs.freqs, out_prefix, col_name, "freqs");
-    run<vbyte>(inputs.docids, out_prefix, col_name, "docids");
-    run<vbyte>(inputs.freqs, out_prefix, col_name, "freqs");
-    run<op4<128> >(inputs.docids, out_prefix, col_name, "docids");
-    run<op4<128> >(inputs.freqs, out_prefix, col_name, "freqs");
-    run<simple16>(inputs.docids, out_prefix, col_name, "docids");
-    run<simple16>(inputs.freqs, out_prefix, col_name, "freqs");
-    run<interpolative>(inputs.docids, out_prefix, col_name, "docids");
-    run<interpolative>(inputs.freqs, out_prefix, col_name, "freqs");
-
-    run<ans_simple>(inputs.docids, out_prefix, col_name, "docids");
-    run<ans_simple>(inputs.freqs, out_prefix, col_name, "freqs");
-    run<ans_packed<128> >(inputs.docids, out_prefix, col_name, "docids");
-    run<ans_packed<128> >(inputs.freqs, out_prefix, col_name, "freqs");
-    run<ans_packed<256> >(inputs.docids, out_prefix, col_name, "docids");
-    run<ans_packed<256> >(inputs.freqs, out_prefix, col_name, "freqs");
-    run<ans_vbyte_split<4096> >(inputs.docids, out_prefix, col_name, "docids");
-    run<ans_vbyte_split<4096> >(inputs.freqs, out_prefix, col_name, "freqs");
-    run<ans_vbyte_single<4096> >(inputs.docids, out_prefix, col_name, "docids");
-    run<ans_vbyte_single<4096> >(inputs.freqs, out_prefix, col_name, "freqs");
+    if (speedup) {
+        encode_speedup(inputs.docids, col_name, "docids");
+        encode_speedup(inputs.freqs, col_name, "freqs");
+    }
+
+    // (3) run the benchmarks
+    fprintff(stderr, "ans_vbyte_simd kernel = %s\n",
+        ans_simd_kernel_name(ans_simd_detect_kernel()).c_str());
+    print_result_header();
+    for (auto threads : thread_counts) {
+        num_threads() = threads;
+        fprintff(stderr, "num_threads = %lu\n", num_threads());
+        for (const auto& c : selected) {
+            for (const auto& part : parts) {
+                const auto& ld
+                    = part == "docids" ? inputs.docids : inputs.freqs;
+                for (size_t r = 0; r < reps; r++) {
+                    auto res = c.run(ld, out_prefix, col_name, part);
+                    res.rep = r;
+                    print_result(res);
+                }
+            }
+            bool has_docids = std::find(parts.begin(), parts.end(), "docids")
+                != parts.end();
+            if (intersect && has_docids) {
+                for (size_t num_terms : { 2, 3 }) {
+                    c.intersect(inputs.docids, out_prefix, col_name, num_terms);
+                }
+            }
+        }
+    }
 
     return EXIT_SUCCESS;
 }
@@ -138,6 +138,7 @@ struct bit_stream {
         : of(f)
         , write_mode(write_stuff)
     {
+        buf[0] = buf[1] = buf[2] = 0;
         first_ptr = &buf[0];
         cur_ptr = first_ptr;
         last_ptr = &buf[1];
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "methods.hpp"
+
+/* qmx aligns its output to absolute 16 byte boundaries, so a list encoding
+   depends on where it is written. such codecs are encoded serially */
+template <class t_compressor>
+struct encodes_position_independent : std::true_type {
+};
+template <> struct encodes_position_independent<qmx> : std::false_type {
+};
+
+/* all codec configurations the benchmarks know about. visit_codecs calls
+   v.template add<t_compressor>() once per configuration in a fixed order,
+   so a tool can build whatever it needs per codec (a name, a function
+   pointer to its benchmark, ...) and select codecs by name at runtime. the
+   name of a configuration is t_compressor().name() */
+template <class t_visitor> void visit_codecs(t_visitor& v)
+{
+    v.template add<qmx>();
+    v.template add<vbyte>();
+    v.template add<op4<128> >();
+    v.template add<simple16>();
+    v.template add<interpolative>();
+
+    v.template add<ans_simple<> >();
+    v.template add<ans_simple<ans_mag_model_fast<mag_dec_table_entry_u64> > >();
+    v.template add<ans_simple<ans_mag_model_fast<mag_dec_factored> > >();
+    v.template add<ans_packed<128> >();
+    v.template add<ans_packed<256> >();
+    v.template add<ans_packed<128, true> >();
+    v.template add<ans_packed_opt<128, 8, 1024> >();
+    v.template add<ans_vbyte_split<4096> >();
+    v.template add<ans_vbyte_single<4096> >();
+    v.template add<
+        ans_vbyte_split<4096, 1, ans_byte_model<4096, dec_table_entry_u32> > >();
+    v.template add<ans_vbyte_single<4096, 1,
+        ans_byte_model<4096, dec_table_entry_u32> > >();
+    v.template add<ans_vbyte_split<4096, 1, ans_byte_model<4096>, true> >();
+    v.template add<ans_vbyte_split<4096, 1,
+        ans_byte_model<4096, dec_table_entry_u32>, true> >();
+    v.template add<ans_vbyte_split<4096, 1, tans_byte_model<4096> > >();
+    v.template add<ans_vbyte_single<4096, 1, tans_byte_model<4096> > >();
+    v.template add<ans_vbyte_simd<4096> >();
+    v.template add<ans_vbyte_ctx<4096> >();
+    v.template add<
+        ans_vbyte_ctx<4096, ans_byte_model<4096, dec_table_entry_u32> > >();
+    v.template add<ans_vbyte_multi<4096, 4> >();
+    v.template add<ans_vbyte_multi<4096, 4,
+        ans_byte_model<4096, dec_table_entry_u32> > >();
+    v.template add<ans_svbyte<4096> >();
+    v.template add<
+        ans_svbyte<4096, ans_byte_model<4096, dec_table_entry_u32> > >();
+    v.template add<ans_vbyte_split<4096, 4> >();
+    v.template add<ans_vbyte_single<4096, 4> >();
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+
+#include "index-reader.hpp"
+#include "methods.hpp"
+
+/* docid() of a cursor moved past the end of its list */
+const uint32_t END_DOCID = std::numeric_limits<uint32_t>::max();
+
+/* forward cursor over a docid list of an index_reader. d-gap lists are
+   turned back into docids. codecs without block level access decode the
+   whole list when the cursor is opened */
+template <class t_compressor> struct posting_cursor {
+    using workspace = typename t_compressor::workspace;
+
+private:
+    std::vector<uint32_t> docids;
+    size_t len = 0;
+    size_t pos = 0;
+    uint32_t cur = END_DOCID;
+
+public:
+    posting_cursor(const index_reader<t_compressor>& reader, size_t term_id,
+        workspace& w)
+    {
+        len = reader.list_len(term_id);
+        docids.resize(len + LIST_OUT_PADDING / sizeof(uint32_t));
+        reader.decode_list(term_id, docids.data(), w);
+        if (!reader.codec().required_increasing) {
+            for (size_t i = 1; i < len; i++)
+                docids[i] += docids[i - 1];
+        }
+        cur = len == 0 ? END_DOCID : docids[0];
+    }
+
+    size_t size() const { return len; }
+    uint32_t docid() const { return cur; }
+    void next()
+    {
+        pos++;
+        cur = pos < len ? docids[pos] : END_DOCID;
+    }
+    /* move to the first docid >= target */
+    void next_geq(uint32_t target)
+    {
+        if (cur >= target)
+            return;
+        pos = std::lower_bound(docids.begin() + pos, docids.begin() + len,
+                  target)
+            - docids.begin();
+        cur = pos < len ? docids[pos] : END_DOCID;
+    }
+};
+
+/* ans_packed lists with skips are decoded one block at a time. next_geq
+   finds the target block from the skip table and only decodes that one */
+template <uint32_t t_bs> struct posting_cursor<ans_packed<t_bs, true> > {
+    using codec = ans_packed<t_bs, true>;
+    using workspace = typename codec::workspace;
+
+private:
+    const codec& comp;
+    typename codec::skip_list sl;
+    std::array<uint32_t, t_bs> block;
+    size_t block_id = 0;
+    size_t block_len = 0;
+    size_t pos = 0;
+    uint32_t cur = END_DOCID;
+
+    void decode_block(size_t j)
+    {
+        block_id = j;
+        block_len = codec::block_size(sl, j);
+        comp.decode_block(sl, j, block.data());
+        block[0] += j == 0 ? 0 : codec::block_last(sl, j - 1);
+        for (size_t k = 1; k < block_len; k++)
+            block[k] += block[k - 1];
+        pos = 0;
+        cur = block[0];
+    }
+
+public:
+    posting_cursor(
+        const index_reader<codec>& reader, size_t term_id, workspace&)
+        : comp(reader.codec())
+    {
+        size_t len = reader.list_len(term_id);
+        sl = codec::read_skips(reader.list_ptr(term_id), len);
+        if (len != 0)
+            decode_block(0);
+    }
+
+    size_t size() const { return sl.list_len; }
+    uint32_t docid() const { return cur; }
+    void next()
+    {
+        if (++pos < block_len) {
+            cur = block[pos];
+        } else if (block_id + 1 < sl.num_blocks) {
+            decode_block(block_id + 1);
+        } else {
+            cur = END_DOCID;
+        }
+    }
+    /* move to the first docid >= target */
+    void next_geq(uint32_t target)
+    {
+        if (cur >= target)
+            return;
+        // (1) gallop from the current block until a block ends at or after
+        // target. all blocks before lo end before it
+        size_t lo = block_id;
+        size_t hi = block_id;
+        for (size_t step = 1;
+             hi < sl.num_blocks && codec::block_last(sl, hi) < target;
+             step *= 2) {
+            lo = hi + 1;
+            hi += step;
+        }
+        hi = std::min(hi, sl.num_blocks);
+        // (2) binary search the first such block in [lo,hi]
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (codec::block_last(sl, mid) < target)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo == sl.num_blocks) {
+            cur = END_DOCID;
+            return;
+        }
+        if (lo != block_id)
+            decode_block(lo);
+        // (3) and search inside it
+        pos = std::lower_bound(
+                  block.begin() + pos, block.begin() + block_len, target)
+            - block.begin();
+        cur = block[pos];
+    }
+};
+
+/* write the docids found in all cursors to out and return their number.
+   the shortest list drives the intersection, the others skip forward to
+   its candidates */
+template <class t_cursor>
+size_t intersect(std::vector<t_cursor*> cursors, uint32_t* out)
+{
+    if (cursors.empty())
+        return 0;
+    std::sort(cursors.begin(), cursors.end(),
+        [](const t_cursor* a, const t_cursor* b) {
+            return a->size() < b->size();
+        });
+    size_t n = 0;
+    uint32_t candidate = cursors[0]->docid();
+    size_t i = 1;
+    while (candidate != END_DOCID) {
+        for (; i < cursors.size(); i++) {
+            cursors[i]->next_geq(candidate);
+            if (cursors[i]->docid() != candidate)
+                break;
+        }
+        if (i == cursors.size()) {
+            out[n++] = candidate;
+            cursors[0]->next();
+        } else {
+            cursors[0]->next_geq(cursors[i]->docid());
+        }
+        candidate = cursors[0]->docid();
+        i = 1;
+    }
+    return n;
+}
+
+template <class t_cursor>
+size_t intersect(t_cursor& a, t_cursor& b, uint32_t* out)
+{
+    return intersect(std::vector<t_cursor*>{ &a, &b }, out);
+}
@@ -21,53 +21,144 @@ void REQUIRE_EQUAL(
     }
 }
 
+/* the metadata of an encoded collection is a binary list directory
+
+     u64 header: magic, num_lists, num_postings, len_width, start_width
+     list lengths: num_lists entries of len_width bits
+     list starts: num_lists + 1 entries of start_width bits
+
+   each packed array is padded to a u64 boundary plus one zero word. every
+   entry has the same width so the length and start of list i are read in
+   O(1) straight from the mapped file without parsing anything */
+namespace list_dir {
+const uint64_t MAGIC = 0x3152494453544cULL; /* "LTSDIR1" */
+const size_t HEADER_U64 = 5;
+const uint8_t MAX_WIDTH = 57; /* an entry fits a single unaligned u64 read */
+
+inline uint8_t width(uint64_t max_val)
+{
+    return max_val == 0 ? 0 : 64 - __builtin_clzll(max_val);
+}
+
+inline size_t packed_u64s(size_t n, uint8_t w)
+{
+    return (n * w + 63) / 64 + 1;
+}
+
+inline void write_packed(FILE* f, const uint64_t* vals, size_t n, uint8_t w)
+{
+    std::vector<uint64_t> words(packed_u64s(n, w), 0);
+    for (size_t i = 0; i < n; i++) {
+        size_t bit = i * w;
+        size_t off = bit % 64;
+        words[bit / 64] |= vals[i] << off;
+        if (off + w > 64) {
+            words[bit / 64 + 1] |= vals[i] >> (64 - off);
+        }
+    }
+    size_t ret = fwrite(words.data(), sizeof(uint64_t), words.size(), f);
+    if (ret != words.size()) {
+        quit("writing list directory failed: %lu != %lu", ret, words.size());
+    }
+}
+
+inline uint64_t read_packed(const uint8_t* packed, size_t i, uint8_t w)
+{
+    size_t bit = i * w;
+    uint64_t word;
+    memcpy(&word, packed + bit / 8, sizeof(uint64_t));
+    return (word >> (bit % 8)) & ((1ULL << w) - 1);
+}
+}
+
 void write_metadata(FILE* meta_file, const list_data& ld,
     const std::vector<uint64_t>& list_starts)
 {
-    fprintf(meta_file, "num_lists = %lu\n", ld.num_lists);
-    fprintf(meta_file, "num_postings = %lu\n", ld.num_postings);
+    uint32_t max_len = 0;
+    std::vector<uint64_t> lens(ld.num_lists);
     for (size_t i = 0; i < ld.num_lists; i++) {
-        fprintf(meta_file, "list len %lu = %u\n", i, ld.list_sizes[i]);
+        lens[i] = ld.list_sizes[i];
+        max_len = std::max(max_len, ld.list_sizes[i]);
     }
-    for (size_t i = 0; i < ld.num_lists + 1; i++) {
-        fprintf(meta_file, "list start %lu = %lu\n", i, list_starts[i]);
+    uint8_t len_width = list_dir::width(max_len);
+    uint8_t start_width = list_dir::width(list_starts[ld.num_lists]);
+    if (start_width > list_dir::MAX_WIDTH) {
+        quit("list start %lu too large for the list directory",
+            list_starts[ld.num_lists]);
     }
+    write_u64(meta_file, list_dir::MAGIC);
+    write_u64(meta_file, ld.num_lists);
+    write_u64(meta_file, ld.num_postings);
+    write_u64(meta_file, len_width);
+    write_u64(meta_file, start_width);
+    list_dir::write_packed(meta_file, lens.data(), ld.num_lists, len_width);
+    list_dir::write_packed(
+        meta_file, list_starts.data(), ld.num_lists + 1, start_width);
 }
 
-void read_metadata(
-    FILE* meta_file, list_data& ld, std::vector<uint64_t>& list_starts)
-{
-    // (1) read the meta data
-    size_t num_lists = 0;
-    size_t num_postings = 0;
-    if (fscanf(meta_file, "num_lists = %lu\n", &num_lists) != 1)
-        quit("can't parse num_lists metadata");
-    fprintf(stderr, "num_lists = %lu\n", num_lists);
-    if (fscanf(meta_file, "num_postings = %lu\n", &num_postings) != 1)
-        quit("can't parse num_postings metadata");
-    fprintf(stderr, "num_postings = %lu\n", num_postings);
-    ld = list_data(num_lists);
-    ld.num_postings = num_postings;
-    list_starts.resize(num_lists + 1);
-    for (size_t i = 0; i < ld.num_lists; i++) {
-        size_t list_num = 0;
-        uint32_t len = 0;
-        if (fscanf(meta_file, "list len %lu = %u\n", &list_num, &len) != 2) {
-            quit("can't parse list len metadata");
+/* read only view of a list directory written by write_metadata */
+struct list_directory {
+    mapped_file file;
+    uint64_t num_lists = 0;
+    uint64_t num_postings = 0;
+    uint8_t len_width = 0;
+    uint8_t start_width = 0;
+    const uint8_t* lens = nullptr;
+    const uint8_t* starts = nullptr;
+
+    list_directory(std::string file_name)
+        : file(file_name)
+    {
+        auto header = reinterpret_cast<const uint64_t*>(file.data);
+        if (file.size < list_dir::HEADER_U64 * sizeof(uint64_t)
+            || header[0] != list_dir::MAGIC) {
+            quit("%s is not a list directory", file_name.c_str());
         }
-        ld.list_sizes[list_num] = len;
-        ld.list_ptrs[list_num]
-            = (uint32_t*)aligned_alloc(16, len * sizeof(uint32_t) + 4096);
-    }
-    for (size_t i = 0; i < ld.num_lists + 1; i++) {
-        size_t list_num = 0;
-        uint64_t offset = 0;
-        if (fscanf(meta_file, "list start %lu = %lu\n", &list_num, &offset)
-            != 2) {
-            quit("can't parse list len metadata");
+        num_lists = header[1];
+        num_postings = header[2];
+        len_width = header[3];
+        start_width = header[4];
+        if (len_width > 32 || start_width > list_dir::MAX_WIDTH) {
+            quit("corrupt list directory %s", file_name.c_str());
+        }
+        size_t len_u64s = list_dir::packed_u64s(num_lists, len_width);
+        size_t start_u64s = list_dir::packed_u64s(num_lists + 1, start_width);
+        size_t total_u64s = list_dir::HEADER_U64 + len_u64s + start_u64s;
+        if (file.size != total_u64s * sizeof(uint64_t)) {
+            quit("list directory %s has the wrong size", file_name.c_str());
         }
-        list_starts[list_num] = offset;
+        lens = reinterpret_cast<const uint8_t*>(
+            header + list_dir::HEADER_U64);
+        starts = lens + len_u64s * sizeof(uint64_t);
+    }
+
+    uint32_t list_len(size_t i) const
+    {
+        return list_dir::read_packed(lens, i, len_width);
+    }
+    /* offset of list i in u32s from the start of the encoded data. the
+       encoding of list i ends at list_start(i + 1) */
+    uint64_t list_start(size_t i) const
+    {
+        return list_dir::read_packed(starts, i, start_width);
+    }
+};
+
+/* slack after each decoded list. some decoders write past the list end */
+const size_t LIST_OUT_PADDING = 4096;
+
+/* allocate output buffers for all lists of a directory */
+list_data alloc_lists(const list_directory& dir)
+{
+    list_data ld(dir.num_lists);
+    ld.num_postings = dir.num_postings;
+    for (size_t i = 0; i < ld.num_lists; i++) {
+        uint32_t len = dir.list_len(i);
+        ld.list_sizes[i] = len;
+        ld.list_ptrs[i] = (uint32_t*)aligned_alloc(
+            16, len * sizeof(uint32_t) + LIST_OUT_PADDING);
     }
+    return ld;
 }
 
 void prefix_sum_lists(list_data& ld)
@@ -92,4 +183,61 @@ void undo_prefix_sum_lists(list_data& ld)
             prev = cur;
         }
     }
-}
\ No newline at end of file
+}
+/* the encoded lists of a collection split into parts encoded by one thread
+   each. bufs[p] holds the u32s[p] encoded u32s of part p. list_starts[i]
+   is where list i starts in the parts written one after the other behind a
+   model of model_u32 u32s, list_starts[num_lists] is the end */
+struct encoded_parts {
+    std::vector<std::vector<uint32_t> > bufs;
+    std::vector<uint64_t> u32s;
+    std::vector<uint64_t> list_starts;
+};
+
+/* encode all lists of ld with an initialized comp on up to threads threads.
+   the lists are split into contiguous ranges, so the parts written in order
+   do not depend on the number of threads */
+template <class t_compressor>
+encoded_parts encode_lists(const t_compressor& comp, const list_data& ld,
+    size_t threads, uint64_t model_u32)
+{
+    auto parts = partition_lists(ld, threads);
+    encoded_parts enc;
+    enc.bufs.resize(parts.size());
+    enc.u32s.resize(parts.size(), 0);
+    enc.list_starts.resize(ld.num_lists + 1);
+
+    // (1) encode each range into its own buffer
+    run_parallel(parts.size(), [&](size_t p) {
+        typename t_compressor::workspace ws;
+        size_t first = parts[p].first;
+        size_t last = parts[p].second;
+        uint64_t postings = 0;
+        for (size_t i = first; i < last; i++) {
+            postings += ld.list_sizes[i];
+        }
+        auto& buf = enc.bufs[p];
+        buf.resize(postings * 1.5 + (last - first) * 8 + 1024);
+        uint32_t* initout = buf.data();
+        uint32_t* out = initout;
+        for (size_t i = first; i < last; i++) {
+            enc.list_starts[i] = (out - initout);
+            size_t encoded_u32 = buf.size() - (out - initout);
+            comp.encodeArray(
+                ld.list_ptrs[i], ld.list_sizes[i], out, encoded_u32, ws);
+            out += encoded_u32;
+        }
+        enc.u32s[p] = out - initout;
+    });
+
+    // (2) turn the per part list offsets into global offsets
+    uint64_t offset = model_u32;
+    for (size_t p = 0; p < parts.size(); p++) {
+        for (size_t i = parts[p].first; i < parts[p].second; i++) {
+            enc.list_starts[i] += offset;
+        }
+        offset += enc.u32s[p];
+    }
+    enc.list_starts[ld.num_lists] = offset;
+    return enc;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "cutil.hpp"
+#include "util.hpp"
+
+/* query time access to a collection encoded by the benchmark. the encoded
+   lists and the list directory stay memory mapped and the models are built
+   once when the reader is opened, so decoding a single list only costs the
+   directory lookup and the list decode itself.
+
+   lists are returned the way they were encoded. for codecs with
+   required_increasing set this is the prefix summed list */
+template <class t_compressor> struct index_reader {
+    using workspace = typename t_compressor::workspace;
+
+private:
+    mapped_file content;
+    list_directory dir;
+    t_compressor comp;
+    workspace ws;
+
+public:
+    index_reader(std::string input_method_prefix, bool prefetch = false,
+        bool huge_pages = false)
+        : content(input_method_prefix + ".bin", prefetch, huge_pages)
+        , dir(input_method_prefix + ".metadata")
+    {
+        if (dir.list_start(dir.num_lists) > content.size_u32()) {
+            quit("%s.bin is shorter than its list directory",
+                input_method_prefix.c_str());
+        }
+        comp.dec_init(content.data_u32());
+    }
+
+    size_t num_lists() const { return dir.num_lists; }
+    uint64_t num_postings() const { return dir.num_postings; }
+    uint32_t list_len(size_t term_id) const { return dir.list_len(term_id); }
+    const t_compressor& codec() const { return comp; }
+    /* drop the index from the page cache. the next decodes read it from
+       disk again */
+    void evict_caches() const
+    {
+        content.evict();
+        dir.file.evict();
+    }
+    /* start of the encoding of list term_id */
+    const uint32_t* list_ptr(size_t term_id) const
+    {
+        return content.data_u32() + dir.list_start(term_id);
+    }
+
+    /* decode list term_id into out and return its length. out must hold
+       list_len(term_id) values plus LIST_OUT_PADDING bytes as some codecs
+       write past the end of the list */
+    uint32_t decode_list(size_t term_id, uint32_t* out)
+    {
+        return decode_list(term_id, out, ws);
+    }
+    /* like above. many threads can share one reader as long as each passes
+       its own workspace */
+    uint32_t decode_list(size_t term_id, uint32_t* out, workspace& w) const
+    {
+        uint32_t len = dir.list_len(term_id);
+        uint64_t list_start = dir.list_start(term_id);
+        size_t encoding_size_u32 = dir.list_start(term_id + 1) - list_start;
+        comp.decodeArray(
+            content.data_u32() + list_start, encoding_size_u32, out, len, w);
+        return len;
+    }
+};
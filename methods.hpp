@@ -4,14 +4,28 @@
 #include "FastPFor-master/headers/optpfor.h"
 #include "FastPFor-master/headers/simple16.h"
 #include "FastPFor-master/headers/variablebyte.h"
+#include "ans-packed-opt.hpp"
 #include "ans-packed.hpp"
 #include "ans-simple.hpp"
+#include "ans-svbyte.hpp"
+#include "ans-vbyte-ctx.hpp"
+#include "ans-vbyte-multi.hpp"
+#include "ans-vbyte-simd.hpp"
 #include "ans-vbyte-single.hpp"
 #include "ans-vbyte-split.hpp"
 #include "compress_qmx.h"
 #include "interp.hpp"
 
+/* codecs keep their scratch state in a workspace. the plain
+   encodeArray/decodeArray use one owned by the codec instance, the const
+   overloads taking a workspace can be called from many threads sharing a
+   single instance as long as each thread passes its own workspace */
+
 struct interpolative {
+    struct workspace {
+    };
+    workspace ws;
+
     bool required_increasing = true;
     std::string name() { return "interpolative"; }
     void init(const list_data&, uint32_t*, size_t& nvalue) { nvalue = 0; }
@@ -19,6 +33,11 @@ struct interpolative {
 
     void encodeArray(
         const uint32_t* in, const size_t len, uint32_t* out, size_t& enc_u32)
+    {
+        encodeArray(in, len, out, enc_u32, ws);
+    }
+    void encodeArray(const uint32_t* in, const size_t len, uint32_t* out,
+        size_t& enc_u32, workspace&) const
     {
         // (1) write length later
         *out++ = in[len - 1];
@@ -27,8 +46,13 @@ struct interpolative {
             = interpolative_internal::encode(out, in, len - 1, in[len - 1]);
         enc_u32 = (bw / sizeof(uint32_t)) + 1; // for list len and universe
     }
-    const uint32_t* decodeArray(const uint32_t* in, const size_t /*enc_u32*/,
+    const uint32_t* decodeArray(const uint32_t* in, const size_t enc_u32,
         uint32_t* out, size_t list_len)
+    {
+        return decodeArray(in, enc_u32, out, list_len, ws);
+    }
+    const uint32_t* decodeArray(const uint32_t* in, const size_t /*enc_u32*/,
+        uint32_t* out, size_t list_len, workspace&) const
     {
         uint32_t universe = *in++;
         size_t u32_read
@@ -39,6 +63,11 @@ struct interpolative {
 };
 
 struct vbyte {
+    struct workspace {
+        FastPForLib::VariableByte vb;
+    };
+    workspace ws;
+
     bool required_increasing = false;
     std::string name() { return "vbyte"; }
     void init(const list_data&, uint32_t*, size_t& nvalue) { nvalue = 0; }
@@ -47,20 +76,35 @@ struct vbyte {
     void encodeArray(
         const uint32_t* in, const size_t len, uint32_t* out, size_t& enc_u32)
     {
-        static FastPForLib::VariableByte vb;
-        vb.encodeArray(in, len, out, enc_u32);
+        encodeArray(in, len, out, enc_u32, ws);
+    }
+    void encodeArray(const uint32_t* in, const size_t len, uint32_t* out,
+        size_t& enc_u32, workspace& w) const
+    {
+        w.vb.encodeArray(in, len, out, enc_u32);
     }
     const uint32_t* decodeArray(const uint32_t* in, const size_t enc_u32,
         uint32_t* out, size_t list_len)
     {
-        static FastPForLib::VariableByte vb;
-        return vb.decodeArray(in, enc_u32, out, list_len);
+        return decodeArray(in, enc_u32, out, list_len, ws);
+    }
+    const uint32_t* decodeArray(const uint32_t* in, const size_t enc_u32,
+        uint32_t* out, size_t list_len, workspace& w) const
+    {
+        return w.vb.decodeArray(in, enc_u32, out, list_len);
     }
 };
 
 template <uint32_t t_block_size = 128> struct op4 {
     static_assert(
         t_block_size % 32 == 0, "op4 blocksize must be multiple of 32");
+    using op4_codec = FastPForLib::OPTPFor<t_block_size / 32>;
+    using vb_codec = FastPForLib::VariableByte;
+    struct workspace {
+        FastPForLib::CompositeCodec<op4_codec, vb_codec> op4c;
+    };
+    workspace ws;
+
     bool required_increasing = false;
     std::string name() { return "op4"; }
     void init(const list_data&, uint32_t*, size_t& nvalue) { nvalue = 0; }
@@ -69,22 +113,32 @@ template <uint32_t t_block_size = 128> struct op4 {
     void encodeArray(
         const uint32_t* in, const size_t len, uint32_t* out, size_t& enc_u32)
     {
-        using op4_codec = FastPForLib::OPTPFor<t_block_size / 32>;
-        using vb_codec = FastPForLib::VariableByte;
-        static FastPForLib::CompositeCodec<op4_codec, vb_codec> op4c;
-        op4c.encodeArray(in, len, out, enc_u32);
+        encodeArray(in, len, out, enc_u32, ws);
+    }
+    void encodeArray(const uint32_t* in, const size_t len, uint32_t* out,
+        size_t& enc_u32, workspace& w) const
+    {
+        w.op4c.encodeArray(in, len, out, enc_u32);
     }
     const uint32_t* decodeArray(const uint32_t* in, const size_t enc_u32,
         uint32_t* out, size_t list_len)
     {
-        using op4_codec = FastPForLib::OPTPFor<t_block_size / 32>;
-        using vb_codec = FastPForLib::VariableByte;
-        static FastPForLib::CompositeCodec<op4_codec, vb_codec> op4c;
-        return op4c.decodeArray(in, enc_u32, out, list_len);
+        return decodeArray(in, enc_u32, out, list_len, ws);
+    }
+    const uint32_t* decodeArray(const uint32_t* in, const size_t enc_u32,
+        uint32_t* out, size_t list_len, workspace& w) const
+    {
+        return w.op4c.decodeArray(in, enc_u32, out, list_len);
     }
 };
 
 struct simple16 {
+    using s16_codec = FastPForLib::Simple16<false>;
+    struct workspace {
+        s16_codec s16;
+    };
+    workspace ws;
+
     bool required_increasing = false;
     std::string name() { return "simple16"; }
     void init(const list_data&, uint32_t*, size_t& nvalue) { nvalue = 0; }
@@ -93,20 +147,31 @@ struct simple16 {
     void encodeArray(
         const uint32_t* in, const size_t len, uint32_t* out, size_t& enc_u32)
     {
-        using s16_codec = FastPForLib::Simple16<false>;
-        static s16_codec s16;
-        s16.encodeArray(in, len, out, enc_u32);
+        encodeArray(in, len, out, enc_u32, ws);
+    }
+    void encodeArray(const uint32_t* in, const size_t len, uint32_t* out,
+        size_t& enc_u32, workspace& w) const
+    {
+        w.s16.encodeArray(in, len, out, enc_u32);
     }
     const uint32_t* decodeArray(const uint32_t* in, const size_t enc_u32,
         uint32_t* out, size_t list_len)
     {
-        using s16_codec = FastPForLib::Simple16<false>;
-        static s16_codec s16;
-        return s16.decodeArray(in, enc_u32, out, list_len);
+        return decodeArray(in, enc_u32, out, list_len, ws);
+    }
+    const uint32_t* decodeArray(const uint32_t* in, const size_t enc_u32,
+        uint32_t* out, size_t list_len, workspace& w) const
+    {
+        return w.s16.decodeArray(in, enc_u32, out, list_len);
     }
 };
 
 struct qmx {
+    struct workspace {
+        compress_qmx qc;
+    };
+    workspace ws;
+
     bool required_increasing = false;
     std::string name() { return "qmx"; }
     void init(const list_data&, uint32_t*, size_t& nvalue) { nvalue = 0; }
@@ -115,18 +180,26 @@ struct qmx {
     void encodeArray(
         const uint32_t* in, const size_t len, uint32_t* out, size_t& enc_u32)
     {
-        static compress_qmx qc;
-
+        encodeArray(in, len, out, enc_u32, ws);
+    }
+    void encodeArray(const uint32_t* in, const size_t len, uint32_t* out,
+        size_t& enc_u32, workspace& w) const
+    {
         // align output ptr to 128 bit boundaries as required by compress_qmx
         size_t bytes_left = 10000000;
         out = align_ptr(16, 1, out, bytes_left);
         size_t align_u32 = (10000000 - bytes_left) / (sizeof(uint32_t));
 
-        qc.encodeArray(in, len, out, &enc_u32);
+        w.qc.encodeArray(in, len, out, &enc_u32);
         enc_u32 += align_u32;
     }
     const uint32_t* decodeArray(
         const uint32_t* in, size_t enc_u32, uint32_t* out, size_t list_len)
+    {
+        return decodeArray(in, enc_u32, out, list_len, ws);
+    }
+    const uint32_t* decodeArray(const uint32_t* in, size_t enc_u32,
+        uint32_t* out, size_t list_len, workspace& w) const
     {
         // align input ptr to 128 bit boundaries as required by compress_qmx
         size_t bytes_left = 10000000;
@@ -141,7 +214,6 @@ struct qmx {
                 reinterpret_cast<size_t>(in), reinterpret_cast<size_t>(out));
         }
 
-        static compress_qmx qc;
-        return qc.decodeArray(in, enc_u32, out, list_len);
+        return w.qc.decodeArray(in, enc_u32, out, list_len);
     }
 };
@@ -2,9 +2,13 @@
 // in one cpp file
 #include "catch.hpp"
 
+#include "codec-registry.hpp"
+#include "cursor.hpp"
+#include "cutil.hpp"
 #include "methods.hpp"
 
 #include <random>
+#include <set>
 
 template <class t_dist>
 std::vector<uint32_t> generate_random_data(t_dist& d, size_t num_elems)
@@ -336,3 +340,669 @@ TEST_CASE("next_power_of_two", "[ans-util]")
     REQUIRE(next_power_of_two(15) == 16);
     REQUIRE(next_power_of_two(19) == 32);
 }
+
+TEST_CASE("normalize_freqs_power_of_two_alistair", "[ans-util]")
+{
+    const size_t target_power = 4096;
+    SECTION("no overshoot")
+    {
+        std::vector<uint64_t> freqs{ 0, 100, 50, 25, 0, 12, 6, 3 };
+        auto nfreqs
+            = normalize_freqs_power_of_two_alistair(freqs, target_power);
+        REQUIRE(std::accumulate(nfreqs.begin(), nfreqs.end(), 0ULL)
+            == target_power);
+        for (size_t i = 0; i < freqs.size(); i++)
+            REQUIRE((freqs[i] == 0) == (nfreqs[i] == 0));
+    }
+    SECTION("many rare symbols overshoot")
+    {
+        // one dominant symbol and 3000 symbols rounded up to 1
+        std::vector<uint64_t> freqs(3001, 1);
+        freqs[0] = 1000000;
+        auto nfreqs
+            = normalize_freqs_power_of_two_alistair(freqs, target_power);
+        REQUIRE(std::accumulate(nfreqs.begin(), nfreqs.end(), 0ULL)
+            == target_power);
+        // a wrapped around entry would still sum to the target mod 2^64
+        for (size_t i = 0; i < freqs.size(); i++) {
+            REQUIRE(nfreqs[i] != 0);
+            REQUIRE(nfreqs[i] < target_power);
+        }
+    }
+}
+
+TEST_CASE("ans_reciprocal", "[ans-util]")
+{
+    std::mt19937 gen(42);
+    SECTION("small frequencies all states")
+    {
+        for (uint64_t f = 1; f <= 64; f++) {
+            ans_reciprocal r(f);
+            uint64_t wrong = 0;
+            for (uint64_t x = 0; x < (f << 16); x++) {
+                wrong += (r.div(x) != x / f);
+            }
+            REQUIRE(wrong == 0);
+        }
+    }
+    SECTION("random frequencies and states")
+    {
+        for (size_t i = 0; i < 100000; i++) {
+            uint64_t f = 1 + (gen() % (1ULL << (1 + gen() % 30)));
+            uint64_t max_x = f << 16;
+            uint64_t x = ((uint64_t(gen()) << 32) | gen()) % max_x;
+            ans_reciprocal r(f);
+            REQUIRE(r.div(x) == x / f);
+            REQUIRE(r.div(max_x - 1) == (max_x - 1) / f);
+        }
+    }
+    SECTION("explicit state range")
+    {
+        for (size_t i = 0; i < 100000; i++) {
+            uint8_t x_bits = 1 + gen() % 48;
+            uint64_t f = 1 + (gen() % (1ULL << (1 + gen() % 30)));
+            uint64_t max_x = 1ULL << x_bits;
+            uint64_t x = ((uint64_t(gen()) << 32) | gen()) % max_x;
+            ans_reciprocal r(f, x_bits);
+            REQUIRE(r.div(x) == x / f);
+            REQUIRE(r.div(max_x - 1) == (max_x - 1) / f);
+        }
+    }
+    SECTION("63 bit states")
+    {
+        // the range of the u64 coders of ans_mag_model_fast
+        for (size_t i = 0; i < 100000; i++) {
+            uint64_t f = 1 + (gen() % (1ULL << (1 + gen() % 31)));
+            uint64_t max_x = 1ULL << 63;
+            uint64_t x = ((uint64_t(gen()) << 32) | gen()) % max_x;
+            ans_reciprocal r(f, 63);
+            REQUIRE(r.div(x) == x / f);
+            REQUIRE(r.div(max_x - 1) == (max_x - 1) / f);
+        }
+    }
+}
+
+TEST_CASE("list directory", "[cutil]")
+{
+    std::mt19937 gen(42);
+    std::string file_name = "test-list-directory.metadata";
+    for (uint64_t max_start : { 0ULL, 1000ULL, 1ULL << 40 }) {
+        size_t num_lists = 1 + gen() % 5000;
+        list_data ld(num_lists);
+        std::vector<uint64_t> list_starts(num_lists + 1, 0);
+        for (size_t i = 0; i < num_lists; i++) {
+            ld.list_sizes[i] = gen() >> (gen() % 32);
+            ld.num_postings += ld.list_sizes[i];
+            list_starts[i] = i * (max_start / num_lists);
+        }
+        list_starts[num_lists] = max_start;
+
+        auto meta_file = fopen_or_fail(file_name, "wb");
+        write_metadata(meta_file, ld, list_starts);
+        fclose(meta_file);
+
+        list_directory dir(file_name);
+        REQUIRE(dir.num_lists == num_lists);
+        REQUIRE(dir.num_postings == ld.num_postings);
+        for (size_t i = 0; i < num_lists; i++) {
+            REQUIRE(dir.list_len(i) == ld.list_sizes[i]);
+            REQUIRE(dir.list_start(i) == list_starts[i]);
+        }
+        REQUIRE(dir.list_start(num_lists) == max_start);
+    }
+    remove(file_name.c_str());
+}
+
+/* train comp on lists and encode each of them behind the model in out.
+   returns where each encoded list starts in out followed by the end */
+template <class t_codec>
+std::vector<size_t> train_and_encode(t_codec& comp,
+    const std::vector<std::vector<uint32_t> >& lists,
+    std::vector<uint32_t>& out)
+{
+    list_data ld(lists.size());
+    size_t out_u32s = 1 << 16;
+    for (size_t i = 0; i < lists.size(); i++) {
+        ld.list_ptrs[i] = const_cast<uint32_t*>(lists[i].data());
+        ld.list_sizes[i] = lists[i].size();
+        ld.num_postings += lists[i].size();
+        out_u32s += lists[i].size() * 2 + 16;
+    }
+    out.resize(out_u32s);
+    size_t model_u32 = 0;
+    comp.init(ld, out.data(), model_u32);
+    for (auto& ptr : ld.list_ptrs)
+        ptr = nullptr; // owned by lists
+    std::vector<size_t> starts(1, model_u32);
+    for (const auto& list : lists) {
+        size_t enc_u32 = 0;
+        comp.encodeArray(
+            list.data(), list.size(), out.data() + starts.back(), enc_u32);
+        starts.push_back(starts.back() + enc_u32);
+    }
+    return starts;
+}
+
+/* train t_codec on lists and decode each of them with a second instance
+   initialized from the stored model */
+template <class t_codec>
+void train_and_round_trip(const std::vector<std::vector<uint32_t> >& lists)
+{
+    t_codec comp;
+    std::vector<uint32_t> out;
+    auto starts = train_and_encode(comp, lists, out);
+
+    t_codec dcomp;
+    REQUIRE(dcomp.dec_init(out.data()) == out.data() + starts[0]);
+    for (size_t i = 0; i < lists.size(); i++) {
+        size_t n = lists[i].size();
+        std::vector<uint32_t> recovered(n + 1024);
+        auto end = dcomp.decodeArray(out.data() + starts[i],
+            starts[i + 1] - starts[i], recovered.data(), n);
+        REQUIRE(size_t(end - recovered.data()) == n);
+        recovered.resize(n);
+        REQUIRE(recovered == lists[i]);
+    }
+}
+
+/* lists of the given lengths whose values take 1 to max_bytes vbyte bytes,
+   each length equally likely */
+std::vector<std::vector<uint32_t> > generate_vbyte_lists(
+    const std::vector<size_t>& sizes, uint32_t max_bytes)
+{
+    std::mt19937 gen(42);
+    std::vector<std::vector<uint32_t> > lists;
+    for (size_t n : sizes) {
+        std::vector<uint32_t> list(n);
+        for (size_t i = 0; i < n; i++) {
+            uint32_t len = 1 + gen() % max_bytes;
+            uint32_t min_val = len == 1 ? 1 : 1U << (7 * (len - 1));
+            uint32_t max_val = len == 5 ? 0xFFFFFFFF : (1U << (7 * len)) - 1;
+            list[i] = min_val + gen() % (max_val - min_val + 1);
+        }
+        lists.push_back(list);
+    }
+    return lists;
+}
+
+TEST_CASE("ans_packed skip table", "[ans-packed]")
+{
+    using codec = ans_packed<128, true>;
+    std::mt19937 gen(42);
+    std::geometric_distribution<> d(0.01);
+    for (size_t n : { 0, 1, 127, 128, 129, 1000, 100000 }) {
+        auto data = generate_random_data(d, n);
+        codec comp;
+        std::vector<uint32_t> out;
+        auto starts = train_and_encode(comp, { data }, out);
+
+        codec dcomp;
+        auto in = dcomp.dec_init(out.data());
+        std::vector<uint32_t> recovered(n + 1024);
+        dcomp.decodeArray(in, starts[1] - starts[0], recovered.data(), n);
+        recovered.resize(n);
+        REQUIRE(recovered == data);
+
+        // every block decodes on its own and ends at its skip value
+        auto sl = codec::read_skips(in, n);
+        REQUIRE(sl.num_blocks == codec::num_blocks(n));
+        uint32_t last = 0;
+        for (size_t j = 0; j < sl.num_blocks; j++) {
+            std::vector<uint32_t> block(128);
+            auto end = dcomp.decode_block(sl, j, block.data());
+            REQUIRE(size_t(end - block.data()) == codec::block_size(sl, j));
+            for (size_t k = 0; k < codec::block_size(sl, j); k++) {
+                REQUIRE(block[k] == data[j * 128 + k]);
+                last += block[k];
+            }
+            REQUIRE(codec::block_last(sl, j) == last);
+        }
+    }
+}
+
+TEST_CASE("ans_packed_opt coding and decoding", "[ans-packed]")
+{
+    using codec = ans_packed_opt<128, 8, 1024>;
+    std::geometric_distribution<> dense(0.5);
+    std::geometric_distribution<> sparse(0.001);
+    for (size_t n : { 1, 7, 8, 129, 1023, 1024, 1025, 100000 }) {
+        // runs of small and large values so the encoder picks mixed sizes
+        auto data = generate_random_data(dense, n);
+        auto large = generate_random_data(sparse, n);
+        for (size_t i = 0; i < n; i++) {
+            if ((i / 100) % 3 == 0)
+                data[i] = large[i];
+        }
+        train_and_round_trip<codec>({ data });
+    }
+}
+
+TEST_CASE("ans_svbyte coding and decoding", "[ans-svbyte]")
+{
+    // values of every stream vbyte length in lists ending in partial groups
+    std::mt19937 gen(42);
+    std::vector<std::vector<uint32_t> > lists;
+    for (size_t n : { 1, 2, 3, 4, 5, 6, 7, 8, 9, 127, 1000, 100003 }) {
+        std::vector<uint32_t> list(n);
+        for (size_t i = 0; i < n; i++) {
+            uint32_t len = 1 + gen() % 4;
+            uint32_t min_val = len == 1 ? 1 : 1U << (8 * (len - 1));
+            uint32_t max_val = len == 4 ? 0xFFFFFFFF : (1U << (8 * len)) - 1;
+            list[i] = min_val + gen() % (max_val - min_val + 1);
+        }
+        lists.push_back(list);
+    }
+    SECTION("default decode table")
+    {
+        train_and_round_trip<ans_svbyte<4096> >(lists);
+    }
+    SECTION("compact decode table")
+    {
+        train_and_round_trip<ans_svbyte<4096,
+            ans_byte_model<4096, dec_table_entry_u32> > >(lists);
+    }
+}
+
+TEST_CASE("ans_vbyte_ctx coding and decoding", "[ans-vbyte-ctx]")
+{
+    // all values fit in 3 vbyte bytes so the context of 4 byte values
+    // never occurs in training and its model is empty
+    auto lists = generate_vbyte_lists({ 1, 2, 1000, 100000 }, 3);
+    train_and_round_trip<ans_vbyte_ctx<4096> >(lists);
+}
+
+/* lists of the given lengths whose values fall in magnitudes 0 to max_mag,
+   each magnitude equally likely */
+std::vector<std::vector<uint32_t> > generate_mag_lists(
+    const std::vector<size_t>& sizes, uint8_t max_mag)
+{
+    std::mt19937 gen(42);
+    std::vector<std::vector<uint32_t> > lists;
+    for (size_t n : sizes) {
+        std::vector<uint32_t> list(n);
+        for (size_t i = 0; i < n; i++) {
+            uint8_t mag = gen() % (max_mag + 1);
+            uint32_t min_val = ans_min_val_in_mag(mag);
+            uint32_t uniq = ans_uniq_vals_in_mag(mag, 0xFFFFFFFF);
+            list[i] = min_val + gen() % uniq;
+        }
+        lists.push_back(list);
+    }
+    return lists;
+}
+
+/* round trips with t_num_states interleaved states over lists whose
+   lengths and byte counts are mostly not multiples of it, some below it */
+template <uint32_t t_num_states> void test_interleaved_states()
+{
+    INFO("states " << t_num_states);
+    using single = ans_vbyte_single<4096, t_num_states>;
+    using split = ans_vbyte_split<4096, t_num_states>;
+    std::vector<size_t> sizes{ 1, 2, 3, 5, 7, 9, 13, 1001, 10007 };
+    for (uint32_t max_bytes : { 1, 2, 5 }) {
+        auto lists = generate_vbyte_lists(sizes, max_bytes);
+        train_and_round_trip<single>(lists);
+        train_and_round_trip<split>(lists);
+    }
+}
+
+TEST_CASE("factored magnitude decode table", "[ans-simple]")
+{
+    // values of every magnitude up to the largest one a model can hold,
+    // in lists shorter than the window as well as long ones
+    auto lists = generate_mag_lists(
+        { 1, 2, 3, 17, 1000, 100000 }, constants::MAX_MAG);
+    train_and_round_trip<ans_simple<ans_mag_model_fast<mag_dec_factored> > >(
+        lists);
+}
+
+TEST_CASE("ans_simple values at the ends of a magnitude", "[ans-simple]")
+{
+    // the largest and smallest value of the top magnitude, the largest
+    // also being the collection maximum, at the ends of the frame range
+    for (int h : { 16, 20, 24, int(constants::MAX_MAG) }) {
+        INFO("magnitude " << h);
+        auto lists = generate_mag_lists({ 1, 2, 1000, 10000 }, h);
+        uint32_t top = ans_max_val_in_mag(h, 0xFFFFFFFF);
+        for (auto& list : lists) {
+            list.front() = top;
+            list.back() = ans_min_val_in_mag(h);
+        }
+        lists[2][500] = top;
+        train_and_round_trip<ans_simple<> >(lists);
+    }
+}
+
+TEST_CASE("compact decode table entries", "[ans-compact]")
+{
+    // the magnitude entry recovers the frequency from values of every
+    // magnitude, the byte entry packs frequencies and offsets up to the
+    // frame size of 4096 into 12 bits each
+    SECTION("magnitude model")
+    {
+        auto lists = generate_mag_lists(
+            { 1, 2, 3, 17, 1000, 100000 }, constants::MAX_MAG);
+        train_and_round_trip<
+            ans_simple<ans_mag_model_fast<mag_dec_table_entry_u64> > >(lists);
+    }
+    SECTION("byte model")
+    {
+        auto lists = generate_vbyte_lists({ 1, 2, 3, 1000, 100000 }, 5);
+        train_and_round_trip<ans_vbyte_single<4096, 1,
+            ans_byte_model<4096, dec_table_entry_u32> > >(lists);
+    }
+    SECTION("byte model with one symbol taking the whole frame")
+    {
+        std::vector<std::vector<uint32_t> > lists{ { 1 },
+            std::vector<uint32_t>(1000, 1) };
+        train_and_round_trip<ans_vbyte_single<4096, 1,
+            ans_byte_model<4096, dec_table_entry_u32> > >(lists);
+    }
+}
+
+TEST_CASE("interleaved states coding and decoding", "[ans-interleaved]")
+{
+    test_interleaved_states<2>();
+    test_interleaved_states<4>();
+    test_interleaved_states<8>();
+}
+
+TEST_CASE("fused ans_vbyte_split decoding", "[ans-vbyte-split]")
+{
+    using codec = ans_vbyte_split<4096, 1, ans_byte_model<4096>, true>;
+    std::vector<size_t> sizes{ 1, 2, 3, 127, 1000, 100000 };
+    SECTION("values of up to 5 vbyte bytes")
+    {
+        train_and_round_trip<codec>(generate_vbyte_lists(sizes, 5));
+    }
+    SECTION("values below 128 leave the remainder model empty")
+    {
+        train_and_round_trip<codec>(generate_vbyte_lists(sizes, 1));
+    }
+}
+
+TEST_CASE("tans_byte_model coding and decoding", "[ans-tans]")
+{
+    using single = ans_vbyte_single<4096, 1, tans_byte_model<4096> >;
+    using split = ans_vbyte_split<4096, 1, tans_byte_model<4096> >;
+    std::vector<size_t> sizes{ 1, 1, 2, 3, 127, 1000, 100000 };
+    SECTION("values of every vbyte length")
+    {
+        auto lists = generate_vbyte_lists(sizes, 5);
+        train_and_round_trip<single>(lists);
+        train_and_round_trip<split>(lists);
+    }
+    SECTION("single byte values leave the remainder model empty")
+    {
+        auto lists = generate_vbyte_lists(sizes, 1);
+        train_and_round_trip<single>(lists);
+        train_and_round_trip<split>(lists);
+    }
+    SECTION("lists of one value")
+    {
+        auto lists = generate_vbyte_lists({ 1, 1, 1, 1, 1 }, 5);
+        train_and_round_trip<single>(lists);
+        train_and_round_trip<split>(lists);
+    }
+}
+
+TEST_CASE("ans_vbyte_multi coding and decoding", "[ans-vbyte-multi]")
+{
+    // dense and sparse lists of all lengths end up in different clusters
+    using codec = ans_vbyte_multi<4096, 4>;
+    std::geometric_distribution<> dense(0.5);
+    std::geometric_distribution<> sparse(0.0001);
+    std::vector<std::vector<uint32_t> > lists;
+    for (size_t n : { 1, 10, 100, 1000, 10000, 100000 }) {
+        lists.push_back(generate_random_data(dense, n));
+        lists.push_back(generate_random_data(sparse, n));
+    }
+    codec comp;
+    std::vector<uint32_t> out;
+    auto starts = train_and_encode(comp, lists, out);
+    std::set<uint8_t> model_ids;
+    for (size_t i = 0; i < lists.size(); i++)
+        model_ids.insert(*reinterpret_cast<uint8_t*>(&out[starts[i]]));
+    REQUIRE(model_ids.size() > 1);
+
+    train_and_round_trip<codec>(lists);
+}
+
+TEST_CASE("ans_vbyte_simd kernels", "[ans-vbyte-simd]")
+{
+    // every kernel the cpu supports decodes what the encoder wrote
+    using codec = ans_vbyte_simd<4096>;
+    std::geometric_distribution<> d(0.01);
+    std::vector<std::vector<uint32_t> > lists;
+    for (size_t n : { 1, 15, 16, 17, 1000, 100000 })
+        lists.push_back(generate_random_data(d, n));
+    codec comp;
+    std::vector<uint32_t> out;
+    auto starts = train_and_encode(comp, lists, out);
+
+    auto widest = ans_simd_detect_kernel();
+    for (auto k : { ans_simd_kernel::scalar, ans_simd_kernel::avx2,
+             ans_simd_kernel::avx512 }) {
+        if (k > widest)
+            continue;
+        INFO("kernel " << ans_simd_kernel_name(k));
+        codec dcomp(k);
+        dcomp.dec_init(out.data());
+        for (size_t i = 0; i < lists.size(); i++) {
+            size_t n = lists[i].size();
+            std::vector<uint32_t> recovered(n + 1024);
+            dcomp.decodeArray(out.data() + starts[i],
+                starts[i + 1] - starts[i], recovered.data(), n);
+            recovered.resize(n);
+            REQUIRE(recovered == lists[i]);
+        }
+    }
+}
+
+/* write the d-gap lists in ld as an index with prefix out_prefix */
+template <class t_compressor>
+void write_test_index(const list_data& ld, std::string out_prefix)
+{
+    t_compressor comp;
+    std::vector<uint32_t> out(ld.num_postings * 4 + (1 << 20));
+    size_t model_u32 = 0;
+    comp.init(ld, out.data(), model_u32);
+    std::vector<uint64_t> list_starts(ld.num_lists + 1);
+    uint32_t* out_ptr = out.data() + model_u32;
+    for (size_t i = 0; i < ld.num_lists; i++) {
+        list_starts[i] = out_ptr - out.data();
+        size_t enc_u32 = out.size() - (out_ptr - out.data());
+        comp.encodeArray(ld.list_ptrs[i], ld.list_sizes[i], out_ptr, enc_u32);
+        out_ptr += enc_u32;
+    }
+    list_starts[ld.num_lists] = out_ptr - out.data();
+    auto out_file = fopen_or_fail(out_prefix + ".bin", "wb");
+    write_u32s(out_file, out.data(), out_ptr - out.data());
+    fclose(out_file);
+    auto meta_file = fopen_or_fail(out_prefix + ".metadata", "wb");
+    write_metadata(meta_file, ld, list_starts);
+    fclose(meta_file);
+}
+
+template <class t_compressor> void test_intersect()
+{
+    // lists sampling the same docid range with different densities
+    std::mt19937 gen(42);
+    const size_t num_lists = 4;
+    const uint32_t universe = 100000;
+    list_data ld(num_lists);
+    std::vector<std::vector<uint32_t> > docids(num_lists);
+    for (size_t i = 0; i < num_lists; i++) {
+        for (uint32_t d = 1; d < universe; d++) {
+            if (gen() % (2 + 5 * i) == 0)
+                docids[i].push_back(d);
+        }
+        ld.list_sizes[i] = docids[i].size();
+        ld.list_ptrs[i] = (uint32_t*)aligned_alloc(
+            16, docids[i].size() * sizeof(uint32_t));
+        uint32_t prev = 0;
+        for (size_t j = 0; j < docids[i].size(); j++) {
+            ld.list_ptrs[i][j] = docids[i][j] - prev;
+            prev = docids[i][j];
+        }
+        ld.num_postings += docids[i].size();
+    }
+    std::string prefix = "test-intersect";
+    write_test_index<t_compressor>(ld, prefix);
+
+    using cursor_type = posting_cursor<t_compressor>;
+    index_reader<t_compressor> reader(prefix);
+    typename t_compressor::workspace ws;
+    std::vector<uint32_t> out(universe);
+    SECTION("next_geq")
+    {
+        // steps within a block as well as across many blocks
+        cursor_type c(reader, 1, ws);
+        for (uint32_t target = 1; target < universe;
+             target += 1 + gen() % (1U << (gen() % 15))) {
+            c.next_geq(target);
+            auto it = std::lower_bound(
+                docids[1].begin(), docids[1].end(), target);
+            REQUIRE(c.docid() == (it == docids[1].end() ? END_DOCID : *it));
+        }
+        c.next_geq(universe);
+        REQUIRE(c.docid() == END_DOCID);
+    }
+    SECTION("two lists")
+    {
+        cursor_type a(reader, 0, ws);
+        cursor_type b(reader, 2, ws);
+        size_t n = intersect(a, b, out.data());
+        std::vector<uint32_t> expected;
+        std::set_intersection(docids[0].begin(), docids[0].end(),
+            docids[2].begin(), docids[2].end(), std::back_inserter(expected));
+        REQUIRE(std::vector<uint32_t>(out.begin(), out.begin() + n)
+            == expected);
+    }
+    SECTION("k lists")
+    {
+        std::vector<cursor_type> cursors;
+        cursors.reserve(num_lists);
+        std::vector<cursor_type*> ptrs;
+        std::vector<uint32_t> expected = docids[0];
+        for (size_t i = 0; i < num_lists; i++) {
+            cursors.emplace_back(reader, i, ws);
+            std::vector<uint32_t> both;
+            std::set_intersection(expected.begin(), expected.end(),
+                docids[i].begin(), docids[i].end(), std::back_inserter(both));
+            expected.swap(both);
+        }
+        for (auto& c : cursors)
+            ptrs.push_back(&c);
+        size_t n = intersect(ptrs, out.data());
+        REQUIRE(n != 0);
+        REQUIRE(std::vector<uint32_t>(out.begin(), out.begin() + n)
+            == expected);
+    }
+    remove((prefix + ".bin").c_str());
+    remove((prefix + ".metadata").c_str());
+}
+
+TEST_CASE("intersection over op4 lists", "[cursor]")
+{
+    test_intersect<op4<128> >();
+}
+
+TEST_CASE("intersection over ans_packed lists", "[cursor]")
+{
+    test_intersect<ans_packed<128, true> >();
+}
+
+/* d-gap lists of the given lengths alternating between dense and sparse
+   values, so the lists span many magnitudes and vbyte lengths */
+list_data generate_lists(const std::vector<size_t>& sizes)
+{
+    std::geometric_distribution<> dense_dist(0.3);
+    std::geometric_distribution<> sparse_dist(0.0005);
+    size_t total = std::accumulate(sizes.begin(), sizes.end(), size_t(0));
+    auto dense = generate_random_data(dense_dist, total);
+    auto sparse = generate_random_data(sparse_dist, total);
+    list_data ld(sizes.size());
+    size_t offset = 0;
+    for (size_t i = 0; i < sizes.size(); i++) {
+        const auto& vals = i % 2 == 0 ? dense : sparse;
+        ld.list_sizes[i] = sizes[i];
+        ld.list_ptrs[i] = (uint32_t*)aligned_alloc(
+            16, (sizes[i] + 1) * sizeof(uint32_t));
+        std::copy(vals.begin() + offset, vals.begin() + offset + sizes[i],
+            ld.list_ptrs[i]);
+        ld.num_postings += sizes[i];
+        offset += sizes[i];
+    }
+    return ld;
+}
+
+/* the model and all encoded lists of ld written the way the benchmark
+   writes them, with init and encoding both run on threads threads */
+template <class t_compressor>
+std::vector<uint32_t> encode_collection(const list_data& input, size_t threads)
+{
+    list_data ld = input;
+    t_compressor comp;
+    if (comp.required_increasing)
+        prefix_sum_lists(ld);
+    size_t prev_threads = num_threads();
+    num_threads() = threads;
+    std::vector<uint32_t> out(1 << 20);
+    size_t model_u32 = 0;
+    comp.init(ld, out.data(), model_u32);
+    auto enc = encode_lists(comp, ld, threads, model_u32);
+    num_threads() = prev_threads;
+    out.resize(model_u32);
+    for (size_t p = 0; p < enc.bufs.size(); p++)
+        out.insert(out.end(), enc.bufs[p].begin(),
+            enc.bufs[p].begin() + enc.u32s[p]);
+    REQUIRE(enc.list_starts.back() == out.size());
+    return out;
+}
+
+/* encodes a collection with every codec on each of thread_counts threads
+   and checks that the output matches the one of the first count */
+struct thread_count_visitor {
+    const list_data& ld;
+    std::vector<size_t> thread_counts;
+
+    template <class t_compressor> void add()
+    {
+        if (!encodes_position_independent<t_compressor>::value)
+            return;
+        INFO(t_compressor().name());
+        auto expected = encode_collection<t_compressor>(ld, thread_counts[0]);
+        for (size_t threads : thread_counts) {
+            INFO("threads " << threads);
+            REQUIRE(encode_collection<t_compressor>(ld, threads) == expected);
+        }
+    }
+};
+
+TEST_CASE("output does not depend on the number of threads", "[threads]")
+{
+    std::vector<size_t> thread_counts{ 1, 2, 3, 7, 16 };
+    SECTION("many lists, some shorter than the thread count")
+    {
+        std::mt19937 gen(42);
+        std::vector<size_t> sizes{ 1, 2, 3, 1, 5 };
+        for (size_t i = 0; i < 200; i++)
+            sizes.push_back(1 + (gen() >> (gen() % 32)) % 5000);
+        auto ld = generate_lists(sizes);
+        thread_count_visitor v{ ld, thread_counts };
+        visit_codecs(v);
+    }
+    SECTION("fewer lists than threads")
+    {
+        auto ld = generate_lists({ 1000, 3, 20000 });
+        auto parts = partition_lists(ld, 16);
+        REQUIRE(parts.size() <= ld.num_lists);
+        REQUIRE(parts.front().first == 0);
+        REQUIRE(parts.back().second == ld.num_lists);
+        for (size_t p = 1; p < parts.size(); p++)
+            REQUIRE(parts[p].first == parts[p - 1].second);
+        thread_count_visitor v{ ld, thread_counts };
+        visit_codecs(v);
+    }
+}
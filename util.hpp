@@ -4,8 +4,18 @@
 #include <cstdarg>
 #include <cstring>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <thread>
 #include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace std::chrono;
 
@@ -58,6 +68,14 @@ struct list_data {
     std::vector<uint32_t> list_sizes;
     uint64_t num_postings = 0;
     uint64_t num_lists = 0;
+    /* if set all lists live in this one allocation and list_ptrs point
+       into it. otherwise each list is allocated on its own */
+    uint32_t* arena = nullptr;
+
+    /* u32s a list of n elements takes in an arena. lists start on 16 byte
+       boundaries like separately allocated ones */
+    static size_t arena_u32s(size_t n) { return (n + 3) & ~size_t(3); }
+
     list_data(){};
     list_data(list_data&& ld)
     {
@@ -65,8 +83,10 @@ struct list_data {
         num_lists = ld.num_lists;
         list_ptrs = std::move(ld.list_ptrs);
         list_sizes = std::move(ld.list_sizes);
+        arena = ld.arena;
         ld.num_postings = 0;
         ld.num_lists = 0;
+        ld.arena = nullptr;
     }
     list_data(const list_data& ld)
     {
@@ -74,12 +94,16 @@ struct list_data {
         num_lists = ld.num_lists;
         list_ptrs.resize(ld.list_ptrs.size());
         list_sizes = ld.list_sizes;
+        size_t total_u32s = 0;
         for (size_t i = 0; i < num_lists; i++) {
-            list_ptrs[i] = (uint32_t*)aligned_alloc(
-                16, list_sizes[i] * sizeof(uint32_t));
-            for (size_t j = 0; j < list_sizes[i]; j++) {
-                list_ptrs[i][j] = ld.list_ptrs[i][j];
-            }
+            total_u32s += arena_u32s(list_sizes[i]);
+        }
+        arena = (uint32_t*)aligned_alloc(16, total_u32s * sizeof(uint32_t));
+        uint32_t* out = arena;
+        for (size_t i = 0; i < num_lists; i++) {
+            list_ptrs[i] = out;
+            memcpy(out, ld.list_ptrs[i], list_sizes[i] * sizeof(uint32_t));
+            out += arena_u32s(list_sizes[i]);
         }
     }
     list_data& operator=(list_data&& ld)
@@ -88,6 +112,7 @@ struct list_data {
         num_lists = ld.num_lists;
         list_ptrs = std::move(ld.list_ptrs);
         list_sizes = std::move(ld.list_sizes);
+        std::swap(arena, ld.arena);
         ld.num_postings = 0;
         ld.num_lists = 0;
         return *this;
@@ -102,6 +127,10 @@ struct list_data {
     }
     ~list_data()
     {
+        if (arena) {
+            aligned_free(arena);
+            return;
+        }
         for (size_t i = 0; i < num_lists; i++)
             if (list_ptrs[i]) {
                 aligned_free(list_ptrs[i]);
@@ -109,6 +138,105 @@ struct list_data {
     }
 };
 
+/* split the lists into at most num_parts contiguous ranges [first, last)
+   holding roughly the same number of postings */
+inline std::vector<std::pair<size_t, size_t>> partition_lists(
+    const list_data& ld, size_t num_parts)
+{
+    std::vector<std::pair<size_t, size_t>> ranges;
+    if (num_parts == 0)
+        num_parts = 1;
+    uint64_t part_postings = (ld.num_postings + num_parts - 1) / num_parts;
+    size_t first = 0;
+    uint64_t postings = 0;
+    for (size_t i = 0; i < ld.num_lists; i++) {
+        postings += ld.list_sizes[i];
+        if (postings >= part_postings && ranges.size() + 1 < num_parts) {
+            ranges.emplace_back(first, i + 1);
+            first = i + 1;
+            postings = 0;
+        }
+    }
+    if (first < ld.num_lists || ranges.empty())
+        ranges.emplace_back(first, ld.num_lists);
+    return ranges;
+}
+
+inline size_t default_num_threads()
+{
+    size_t n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : n;
+}
+
+/* number of threads used by the parallel encoding and model building
+   stages */
+inline size_t& num_threads()
+{
+    static size_t n = default_num_threads();
+    return n;
+}
+
+/* pin the threads of run_parallel and the benchmark threads to fixed
+   cpus */
+inline bool& pin_threads()
+{
+    static bool pin = false;
+    return pin;
+}
+
+/* pin the calling thread to cpu (modulo the number of cpus) */
+inline void pin_current_thread(size_t cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % default_num_threads(), &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        fprintf(stderr, "pinning thread to cpu %lu failed\n", cpu);
+    }
+}
+
+/* run f(0), ..., f(n - 1) each on its own thread and wait for all of them.
+   with pin_threads set thread i runs on cpu i */
+template <class t_func> void run_parallel(size_t n, t_func f)
+{
+    if (n == 1) {
+        if (pin_threads())
+            pin_current_thread(0);
+        f(0);
+        return;
+    }
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < n; i++) {
+        threads.emplace_back([&f](size_t id) {
+            if (pin_threads())
+                pin_current_thread(id);
+            f(id);
+        },
+            i);
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+/* gather statistics over all lists on num_threads threads. each thread
+   starts from a copy of init and calls count(stats, list, n) for each list
+   of its range. the per thread stats are returned in list order so the
+   caller can merge them */
+template <class t_stats, class t_count>
+std::vector<t_stats> parallel_list_stats(
+    const list_data& ld, const t_stats& init, t_count count)
+{
+    auto parts = partition_lists(ld, num_threads());
+    std::vector<t_stats> stats(parts.size(), init);
+    run_parallel(parts.size(), [&](size_t p) {
+        for (size_t i = parts[p].first; i < parts[p].second; i++) {
+            count(stats[p], ld.list_ptrs[i], ld.list_sizes[i]);
+        }
+    });
+    return stats;
+}
+
 struct ds2i_data {
     uint32_t num_docs;
     list_data docids;
@@ -203,6 +331,103 @@ std::vector<uint32_t> read_file_content_u32(FILE* f)
     return content;
 }
 
+/* read only memory mapping of a whole file. lists are decoded straight
+   from the mapping so only the pages of lists we touch are read. the file
+   is followed by MMAP_PADDING readable zero bytes so decoders can read a
+   little past the end of the last list like they can with a heap buffer.
+   prefetch asks the kernel to read the whole file ahead (MADV_WILLNEED),
+   huge_pages asks for transparent huge pages where supported */
+struct mapped_file {
+    static const size_t MMAP_PADDING = 4096;
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    size_t mapped_size = 0;
+    std::string file_name;
+
+    mapped_file() = default;
+    mapped_file(
+        std::string _file_name, bool prefetch = false, bool huge_pages = false)
+        : file_name(_file_name)
+    {
+        int fd = open(file_name.c_str(), O_RDONLY);
+        if (fd < 0) {
+            quit("opening file %s failed", file_name.c_str());
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            quit("stat of file %s failed", file_name.c_str());
+        }
+        size = st.st_size;
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        size_t file_pages = (size + page_size - 1) / page_size * page_size;
+        mapped_size = file_pages + MMAP_PADDING;
+
+        // (1) reserve zeroed space for the file plus padding
+        void* base = mmap(nullptr, mapped_size, PROT_READ,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) {
+            quit("mmap of %lu bytes failed", mapped_size);
+        }
+        // (2) map the file over the start of it
+        if (size != 0) {
+            void* file_base
+                = mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+            if (file_base == MAP_FAILED) {
+                quit("mmap of file %s failed", file_name.c_str());
+            }
+        }
+        close(fd);
+        data = reinterpret_cast<const uint8_t*>(base);
+
+        // (3) access hints
+        if (prefetch) {
+            madvise(base, file_pages, MADV_WILLNEED);
+        }
+#ifdef MADV_HUGEPAGE
+        if (huge_pages) {
+            madvise(base, file_pages, MADV_HUGEPAGE);
+        }
+#else
+        (void)huge_pages;
+#endif
+    }
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+    mapped_file(mapped_file&& other) { *this = std::move(other); }
+    mapped_file& operator=(mapped_file&& other)
+    {
+        std::swap(data, other.data);
+        std::swap(size, other.size);
+        std::swap(mapped_size, other.mapped_size);
+        std::swap(file_name, other.file_name);
+        return *this;
+    }
+    ~mapped_file()
+    {
+        if (data) {
+            munmap(const_cast<uint8_t*>(data), mapped_size);
+        }
+    }
+
+    /* drop the mapped pages and the page cache of the file so the next
+       access has to read from disk again */
+    void evict() const
+    {
+        madvise(const_cast<uint8_t*>(data), mapped_size, MADV_DONTNEED);
+        int fd = open(file_name.c_str(), O_RDONLY);
+        if (fd >= 0) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+    }
+
+    const uint32_t* data_u32() const
+    {
+        return reinterpret_cast<const uint32_t*>(data);
+    }
+    size_t size_u32() const { return size / sizeof(uint32_t); }
+};
+
 FILE* fopen_or_fail(std::string file_name, const char* mode)
 {
     FILE* out_file = fopen(file_name.c_str(), mode);
@@ -325,17 +550,53 @@ inline const uint32_t* align_ptr(size_t __align, size_t __size,
     }
 }
 
-std::vector<uint32_t> read_uint32_list(FILE* f)
+/* load all lists of a ds2i .docs or .freqs file into a single arena. the
+   file is a sequence of lists each stored as its length followed by its
+   values. every value is incremented by one so there are no 0s. .docs
+   files start with a list holding the number of documents which is
+   skipped with skip_first */
+list_data read_ds2i_lists(std::string file_name, bool skip_first)
 {
-    uint32_t list_len = read_u32(f);
-    if (list_len == 0)
-        return std::vector<uint32_t>();
-    std::vector<uint32_t> list(list_len);
-    read_u32s(f, list.data(), list_len);
-    for (uint32_t j = 0; j < list_len; j++) {
-        list[j]++; // ensure there are no 0s
-    }
-    return list;
+    mapped_file content(file_name, true);
+    const uint32_t* in = content.data_u32();
+    size_t in_u32s = content.size_u32();
+
+    // (1) find the lists and the size of the arena
+    list_data ld;
+    size_t first = 0;
+    if (skip_first && in_u32s != 0)
+        first = 1 + size_t(in[0]);
+    size_t total_u32s = 0;
+    for (size_t pos = first; pos < in_u32s;) {
+        size_t n = in[pos];
+        if (n == 0)
+            break;
+        if (pos + 1 + n > in_u32s)
+            quit("list %lu of %s is truncated", ld.list_sizes.size(),
+                file_name.c_str());
+        ld.list_sizes.push_back(n);
+        ld.num_postings += n;
+        total_u32s += list_data::arena_u32s(n);
+        pos += 1 + n;
+    }
+    ld.num_lists = ld.list_sizes.size();
+
+    // (2) copy the lists over adding one to each value
+    ld.arena = (uint32_t*)aligned_alloc(16, total_u32s * sizeof(uint32_t));
+    ld.list_ptrs.resize(ld.num_lists);
+    uint32_t* out = ld.arena;
+    const uint32_t* list = in + first;
+    for (size_t i = 0; i < ld.num_lists; i++) {
+        size_t n = ld.list_sizes[i];
+        list++; // length
+        for (size_t j = 0; j < n; j++) {
+            out[j] = list[j] + 1;
+        }
+        ld.list_ptrs[i] = out;
+        out += list_data::arena_u32s(n);
+        list += n;
+    }
+    return ld;
 }
 
 ds2i_data read_all_input_ds2i(std::string ds2i_prefix)
@@ -343,47 +604,14 @@ ds2i_data read_all_input_ds2i(std::string ds2i_prefix)
     ds2i_data ds2i;
     timer t("read input lists from " + ds2i_prefix);
 
-    std::string docs_file = ds2i_prefix + ".docs";
-    auto df = fopen_or_fail(docs_file, "rb");
-    {
-        // (1) skip the numdocs list
-        read_uint32_list(df);
-        // (2) keep reading lists
-        uint32_t max_doc_id = 0;
-        while (!feof(df)) {
-            const auto& list = read_uint32_list(df);
-            size_t n = list.size();
-            if (n == 0)
-                break;
-            max_doc_id = std::max(max_doc_id, list.back());
-            ds2i.docids.list_sizes.push_back(n);
-            uint32_t* ptr = (uint32_t*)aligned_alloc(16, n * sizeof(uint32_t));
-            ds2i.docids.list_ptrs.push_back(ptr);
-            auto in_ptr = list.data();
-            memcpy(ptr, in_ptr, n * sizeof(uint32_t));
-            ds2i.docids.num_lists++;
-            ds2i.docids.num_postings += n;
-        }
-        ds2i.num_docs = max_doc_id - 1;
-    }
-
-    std::string freqs_file = ds2i_prefix + ".freqs";
-    auto ff = fopen_or_fail(freqs_file, "rb");
-    {
-        while (!feof(ff)) {
-            const auto& list = read_uint32_list(ff);
-            size_t n = list.size();
-            if (n == 0)
-                break;
-            ds2i.freqs.list_sizes.push_back(n);
-            uint32_t* ptr = (uint32_t*)aligned_alloc(16, n * sizeof(uint32_t));
-            ds2i.freqs.list_ptrs.push_back(ptr);
-            auto in_ptr = list.data();
-            memcpy(ptr, in_ptr, n * sizeof(uint32_t));
-            ds2i.freqs.num_lists++;
-            ds2i.freqs.num_postings += n;
-        }
+    ds2i.docids = read_ds2i_lists(ds2i_prefix + ".docs", true);
+    uint32_t max_doc_id = 0;
+    for (size_t i = 0; i < ds2i.docids.num_lists; i++) {
+        size_t n = ds2i.docids.list_sizes[i];
+        max_doc_id = std::max(max_doc_id, ds2i.docids.list_ptrs[i][n - 1]);
     }
+    ds2i.num_docs = max_doc_id - 1;
+    ds2i.freqs = read_ds2i_lists(ds2i_prefix + ".freqs", false);
 
     fprintf(stderr, "num_docs = %u\n", ds2i.num_docs);
     fprintf(stderr, "num_lists = %lu\n", ds2i.freqs.num_lists);
@@ -391,3 +619,40 @@ ds2i_data read_all_input_ds2i(std::string ds2i_prefix)
 
     return ds2i;
 }
+
+/* read a query log with one query per line given as whitespace separated
+   term ids. empty lines are skipped */
+std::vector<std::vector<uint32_t> > read_query_log(std::string file_name)
+{
+    std::vector<std::vector<uint32_t> > queries;
+    auto f = fopen_or_fail(file_name, "r");
+    std::vector<uint32_t> query;
+    int c = fgetc(f);
+    while (c != EOF) {
+        if (c >= '0' && c <= '9') {
+            uint64_t term_id = 0;
+            while (c >= '0' && c <= '9') {
+                term_id = term_id * 10 + (c - '0');
+                if (term_id > std::numeric_limits<uint32_t>::max())
+                    quit("term id too large in query log %s",
+                        file_name.c_str());
+                c = fgetc(f);
+            }
+            query.push_back(term_id);
+            continue;
+        }
+        if (c == '\n' && !query.empty()) {
+            queries.push_back(query);
+            query.clear();
+        } else if (c != '\n' && !isspace(c)) {
+            quit("unexpected character '%c' in query log %s", c,
+                file_name.c_str());
+        }
+        c = fgetc(f);
+    }
+    if (!query.empty())
+        queries.push_back(query);
+    fclose(f);
+    fprintf(stderr, "num_queries = %lu\n", queries.size());
+    return queries;
+}